@@ -1,5 +1,6 @@
 #include <am.h>
 #include <nemu.h>
+#include <klib.h>
 
 #define AUDIO_FREQ_ADDR      (AUDIO_ADDR + 0x00)
 #define AUDIO_CHANNELS_ADDR  (AUDIO_ADDR + 0x04)
@@ -8,19 +9,47 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+static uint32_t sbuf_size = 0;
+static uint32_t sbuf_tail = 0; // where the next data goes
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - buf;
+  while (len > 0) {
+    // wait for free space, the device keeps playing in the meantime
+    uint32_t count = inl(AUDIO_COUNT_ADDR);
+    uint32_t n = sbuf_size - count;
+    if (n == 0) continue;
+    if (n > len) n = len;
+    uint8_t *sbuf = (uint8_t *)(uintptr_t)AUDIO_SBUF_ADDR;
+    uint32_t first = sbuf_size - sbuf_tail;
+    if (first > n) first = n;
+    memcpy(sbuf + sbuf_tail, buf, first);
+    memcpy(sbuf, buf + first, n - first);
+    sbuf_tail = (sbuf_tail + n) % sbuf_size;
+    // the device only adds the difference to what was read
+    outl(AUDIO_COUNT_ADDR, count + n);
+    buf += n;
+    len -= n;
+  }
 }
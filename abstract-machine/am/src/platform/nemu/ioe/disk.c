@@ -1,12 +1,28 @@
 #include <am.h>
 #include <nemu.h>
 
+#define DISK_PRESENT_ADDR (DISK_ADDR + 0x00)
+#define DISK_BLKSZ_ADDR   (DISK_ADDR + 0x04)
+#define DISK_BLKCNT_ADDR  (DISK_ADDR + 0x08)
+#define DISK_BUF_ADDR     (DISK_ADDR + 0x0c)
+#define DISK_BLKNO_ADDR   (DISK_ADDR + 0x10)
+#define DISK_NBLK_ADDR    (DISK_ADDR + 0x14)
+#define DISK_CMD_ADDR     (DISK_ADDR + 0x18)
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = inl(DISK_PRESENT_ADDR);
+  cfg->blksz = inl(DISK_BLKSZ_ADDR);
+  cfg->blkcnt = inl(DISK_BLKCNT_ADDR);
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  // requests are finished when the command register is written
+  stat->ready = true;
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  outl(DISK_BUF_ADDR, (uintptr_t)io->buf);
+  outl(DISK_BLKNO_ADDR, io->blkno);
+  outl(DISK_NBLK_ADDR, io->blkcnt);
+  outl(DISK_CMD_ADDR, io->write);
 }
@@ -1,20 +1,58 @@
 #include <am.h>
 #include <nemu.h>
 
-#define SYNC_ADDR (VGACTL_ADDR + 4)
+#define SIZE_ADDR   (VGACTL_ADDR + 0x00)
+#define SYNC_ADDR   (VGACTL_ADDR + 0x04)
+#define ACCEL_ADDR  (VGACTL_ADDR + 0x08)
+#define CMD_ADDR    (VGACTL_ADDR + 0x0c)
+#define NR_CMD_ADDR (VGACTL_ADDR + 0x10)
+
+enum { GPU_NOP, GPU_FILL, GPU_COPY, GPU_BLIT };
+
+typedef struct {
+  uint32_t op;
+  uint32_t x, y, w, h;
+  uint32_t arg[3];
+} GPUCmd;
+
+static int W, H;
+static bool has_accel;
 
 void __am_gpu_init() {
+  uint32_t size = inl(SIZE_ADDR);
+  W = size >> 16;
+  H = size & 0xffff;
+  has_accel = inl(ACCEL_ADDR);
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = has_accel,
+    .width = W, .height = H,
+    .vmemsz = W * H * sizeof(uint32_t)
   };
 }
 
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  int x = ctl->x, y = ctl->y, w = ctl->w, h = ctl->h;
+  if (ctl->pixels != NULL && w > 0 && h > 0) {
+    if (has_accel) {
+      // one blit instead of w * h stores to the frame buffer
+      static GPUCmd cmd;
+      cmd = (GPUCmd) { .op = GPU_BLIT, .x = x, .y = y, .w = w, .h = h,
+        .arg = { (uintptr_t)ctl->pixels, w } };
+      outl(CMD_ADDR, (uintptr_t)&cmd);
+      outl(NR_CMD_ADDR, 1);
+    } else {
+      uint32_t *fb = (uint32_t *)(uintptr_t)FB_ADDR;
+      uint32_t *pixels = ctl->pixels;
+      for (int j = 0; j < h && y + j < H; j ++) {
+        for (int i = 0; i < w && x + i < W; i ++) {
+          fb[(y + j) * W + x + i] = pixels[j * w + i];
+        }
+      }
+    }
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
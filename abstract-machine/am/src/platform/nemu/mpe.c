@@ -2,17 +2,46 @@
 #include <stdatomic.h>
 #include <klib-macros.h>
 
-bool mpe_init(void (*entry)()) {
-  entry();
+// the number of harts configured in NEMU, set by `make smp=N'
+#ifndef NR_CPU
+#define NR_CPU 1
+#endif
+
+static void (* volatile user_entry)() = NULL;
+
+static void call_user_entry() {
+  user_entry();
   panic("MPE entry returns");
 }
 
+#if defined(__riscv)
+// 4 KiB stacks of harts 1 to NR_CPU - 1, used by start.S
+uint8_t __am_cpu_stack[NR_CPU - 1][4096] __attribute__((aligned(16)));
+
+void __am_othercpu_entry() {
+  while (user_entry == NULL) ;
+  call_user_entry();
+}
+#endif
+
+bool mpe_init(void (*entry)()) {
+  user_entry = entry;
+  call_user_entry();
+  return true;
+}
+
 int cpu_count() {
-  return 1;
+  return NR_CPU;
 }
 
 int cpu_current() {
+#if defined(__riscv)
+  int id;
+  asm volatile ("csrr %0, mhartid" : "=r"(id));
+  return id;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
@@ -44,6 +44,14 @@ typedef MUXDEF(PMEM64, uint64_t, uint32_t) paddr_t;
 #define FMT_PADDR MUXDEF(PMEM64, "0x%016" PRIx64, "0x%08" PRIx32)
 typedef uint16_t ioaddr_t;
 
+/* With TARGET_LIB, each thread runs its own instance of NEMU, so the state
+ * of the machine is thread-local. See src/libnemu.c. */
+#ifdef CONFIG_TARGET_LIB
+#define MACHINE_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define MACHINE_LOCAL
+#endif
+
 #include <debug.h>
 
 #endif
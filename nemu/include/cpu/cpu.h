@@ -18,10 +18,30 @@
 
 #include <common.h>
 
+/* With SMP, each hart runs in its own host thread, and the state of the
+ * hart being executed is thread-local. */
+#ifdef CONFIG_SMP
+#define NR_HART CONFIG_NR_HART
+#define HART_LOCAL __thread
+extern __thread int hart_id;
+#else
+#define NR_HART 1
+#define HART_LOCAL MACHINE_LOCAL
+#define hart_id 0
+#endif
+
 void cpu_exec(uint64_t n);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
+/* abort the current instruction and take exception `NO' at its pc */
+void longjmp_exception(word_t NO) __attribute__((noreturn));
+
+#ifdef CONFIG_SNAPSHOT
+void snapshot_exec(uint64_t n);
+void snapshot_replay(uint64_t target);
+extern bool snapshot_replaying;
+#endif
 
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
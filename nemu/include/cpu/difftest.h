@@ -24,6 +24,8 @@ void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_intr(word_t NO);
+void difftest_dma(paddr_t addr, size_t len);
 void difftest_detach();
 void difftest_attach();
 #else
@@ -31,10 +33,21 @@ static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_intr(word_t NO) {}
+static inline void difftest_dma(paddr_t addr, size_t len) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
 
+#ifdef CONFIG_DIFFTEST_ASYNC
+void difftest_async_wait();
+#endif
+
+#ifdef CONFIG_DIFFTEST_BATCH
+// set while a batch is re-run to search for a mismatch, no interrupt is taken
+extern bool difftest_replaying;
+#endif
+
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
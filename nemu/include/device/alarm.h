@@ -20,5 +20,8 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+/* check whether the timer fired since the last call, at TIMER_HZ */
+bool alarm_poll();
+void alarm_run();
 
 #endif
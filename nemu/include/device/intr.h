@@ -0,0 +1,51 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+#include <common.h>
+#include <cpu/cpu.h>
+
+/* Interrupt request lines from the devices to the CPU. Their levels are
+ * folded into a single word per hart, so that the CPU loop only tests this
+ * word after each instruction, and asks the ISA for an interrupt to take only
+ * when some line is raised and enabled. */
+enum {
+  INTR_LINE_TIMER = 1 << 0, // timer of NEMU, lowered when the interrupt is taken
+  INTR_LINE_MSIP  = 1 << 1, // software interrupt from the CLINT
+  INTR_LINE_MTIP  = 1 << 2, // timer interrupt from the CLINT
+  INTR_LINE_MEIP  = 1 << 3, // external interrupt from the PLIC
+  INTR_LINE_CLINT = 1 << 4, // the timer of the CLINT may have expired
+};
+
+extern uint32_t dev_intr_lines[NR_HART];
+/* the lines which can be taken with the current enable bits of the ISA, only
+ * written by the hart itself; all of them for an ISA which does not set it */
+extern uint32_t dev_intr_enabled[NR_HART];
+
+static inline bool dev_intr_pending() {
+  return (__atomic_load_n(&dev_intr_lines[hart_id], __ATOMIC_RELAXED) &
+      dev_intr_enabled[hart_id]) != 0;
+}
+
+void dev_set_intr(int hart, uint32_t line, bool level);
+/* handle the requests deferred to the CPU thread and return the levels of the
+ * lines of the current hart */
+uint32_t dev_query_intr();
+// drive the interrupt source `src' of the PLIC
+void plic_set_irq(int src, bool level);
+
+#endif
@@ -17,6 +17,7 @@
 #define __DEVICE_MAP_H__
 
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
@@ -53,4 +54,19 @@ void add_mmio_map(const char *name, paddr_t addr,
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
+// pmem written by a device, e.g. by DMA, which REF does not see otherwise
+static inline void dev_pmem_written(paddr_t addr, size_t len) {
+  pmem_dirty_set(addr, len);
+  difftest_dma(addr, len);
+}
+
+#if defined(CONFIG_SMP) && defined(CONFIG_DEVICE)
+// serialize the harts and the device updates on the state of the devices
+void device_lock();
+void device_unlock();
+#else
+static inline void device_lock() {}
+static inline void device_unlock() {}
+#endif
+
 #endif
@@ -0,0 +1,53 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_REPLAY_H__
+#define __DEVICE_REPLAY_H__
+
+#include <common.h>
+
+/* Non-deterministic inputs observed by the guest */
+enum {
+  REPLAY_KEY,    // scancode read from the keyboard
+  REPLAY_RTC,    // time read from the timer
+  REPLAY_SERIAL, // character or line status read from the serial port
+  REPLAY_AUDIO,  // count of the audio stream buffer
+  REPLAY_MTIME,  // mtime read from the CLINT
+  REPLAY_INTR,   // interrupt taken by the CPU
+  NR_REPLAY,
+};
+
+#ifdef CONFIG_REPLAY
+enum { REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY };
+extern int replay_mode;
+
+void init_replay(const char *record_file, const char *replay_file);
+/* Log the input `val' with the current instruction count when recording,
+ * and return the logged value instead of `val' when replaying. */
+uint64_t replay_input(int type, uint64_t val);
+word_t replay_intr_slow(word_t intr);
+
+/* Return the interrupt to take after the current instruction. When replaying,
+ * the interrupts raised by the devices are ignored, and the logged ones are
+ * taken at the same instruction counts. */
+static inline word_t replay_intr(word_t intr) {
+  if (likely(replay_mode == REPLAY_OFF)) return intr;
+  return replay_intr_slow(intr);
+}
+#else
+static inline uint64_t replay_input(int type, uint64_t val) { return val; }
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_VIRTIO_H__
+#define __DEVICE_VIRTIO_H__
+
+#include <common.h>
+
+/* virtio over MMIO (version 2) with split virtqueues.
+ * https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html */
+
+#define VIRTIO_NR_QUEUE 2
+#define VIRTIO_QUEUE_NUM_MAX 256
+#define VIRTIO_NR_SEG 64
+
+enum { VIRTIO_ID_BLOCK = 2, VIRTIO_ID_CONSOLE = 3 };
+
+typedef struct {
+  uint32_t num;
+  bool ready;
+  uint64_t desc, avail, used; // guest physical addresses of the rings
+  uint16_t last_avail;        // the next entry of the available ring to pop
+  uint16_t used_idx;          // published to the used ring by virtq_flush()
+} VirtQueue;
+
+/* A chain of descriptors popped from the available ring. The buffers are
+ * host pointers into pmem, and those written by the device are marked dirty
+ * when the request is pushed back. */
+typedef struct {
+  uint16_t head;
+  int nr_seg;
+  struct {
+    uint8_t *buf;
+    uint32_t len;
+    bool write; // written by the device
+    paddr_t addr;
+  } seg[VIRTIO_NR_SEG];
+} VirtReq;
+
+typedef struct VirtioDev VirtioDev;
+struct VirtioDev {
+  const char *name;
+  uint32_t device_id; // 0 if there is no backend
+  uint64_t features;  // offered features specific to the device
+  int irq;            // source of the PLIC
+  void *config;
+  uint32_t config_size;
+  // the driver notifies the device that there are new requests in queue `q'
+  void (*notify)(VirtioDev *dev, int q);
+
+  // the state of the transport
+  uint32_t *regs;
+  uint64_t driver_features;
+  uint32_t status, intr_status;
+  VirtQueue queue[VIRTIO_NR_QUEUE];
+};
+
+/* The callback of the MMIO map of each device only forwards the access to
+ * virtio_mmio_io_handler() with the device. */
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr, void (*callback)(uint32_t, int, bool));
+void virtio_mmio_io_handler(VirtioDev *dev, uint32_t offset, int len, bool is_write);
+/* Requests are processed in batches: pop and push every available request,
+ * then publish all of them with a single update of the used ring and at most
+ * one interrupt with virtq_flush(). */
+bool virtq_pop(VirtioDev *dev, int q, VirtReq *req);
+void virtq_push(VirtioDev *dev, int q, VirtReq *req, uint32_t written);
+void virtq_flush(VirtioDev *dev, int q);
+
+#endif
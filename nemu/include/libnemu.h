@@ -0,0 +1,55 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __LIBNEMU_H__
+#define __LIBNEMU_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Embedding API of NEMU built with CONFIG_TARGET_LIB.
+ *
+ * Each nemu_t is a machine of its own, with its own pmem and CPU state. The
+ * functions run an instance on the calling thread, so different instances
+ * can run on different threads at the same time. An instance must not be
+ * used by two threads at the same time, but it may move between threads. */
+typedef struct nemu nemu_t;
+
+// returned by nemu_run()
+enum { NEMU_RUN_STOP, NEMU_RUN_END, NEMU_RUN_ABORT };
+
+// a new machine at the reset state, with the built-in image
+nemu_t* nemu_create();
+void nemu_destroy(nemu_t *nemu);
+
+// load a raw image to the reset vector, return its size or -1 on error
+long nemu_load(nemu_t *nemu, const char *img_file);
+
+/* Execute at most `n' instructions. NEMU_RUN_END means the guest has hit
+ * the trap of NEMU with the code returned by nemu_halt_ret(). */
+int nemu_run(nemu_t *nemu, uint64_t n);
+int nemu_step(nemu_t *nemu);
+int nemu_halt_ret(nemu_t *nemu);
+uint64_t nemu_nr_inst(nemu_t *nemu);
+
+/* Copy the GPRs followed by pc, laid out as DIFFTEST_REG_SIZE in
+ * difftest-def.h, from (to_nemu = false) or to the machine. */
+void nemu_regcpy(nemu_t *nemu, void *regs, bool to_nemu);
+// copy [paddr, paddr + n) of pmem, return false if it is out of pmem
+bool nemu_memcpy(nemu_t *nemu, uint64_t paddr, void *buf, size_t n, bool to_nemu);
+
+#endif
@@ -27,11 +27,49 @@ uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
 
+#ifdef CONFIG_TARGET_LIB
+/* use the pmem of an instance of libnemu in this thread */
+void pmem_bind(uint8_t *p);
+#endif
+
 static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+/* fill the lazily initialized part of [addr, addr + len) before the kernel writes to it */
+void pmem_populate(paddr_t addr, size_t len);
+#else
+static inline void pmem_populate(paddr_t addr, size_t len) {}
+#endif
+
+#ifdef CONFIG_PMEM_DIRTY
+/* Every write to pmem tags its page with the current epoch. pmem_dirty_mark()
+ * starts a new epoch and returns its mark, and the pages written since then are
+ * those tagged with a later or equal epoch. Each user keeps its own mark, so
+ * "clearing" for one user does not affect the others. */
+typedef uint32_t dirty_mark_t;
+#define DIRTY_MARK_BOOT ((dirty_mark_t)1) // everything written since start-up
+typedef void (*dirty_range_handler_t)(paddr_t addr, size_t len, void *arg);
+dirty_mark_t pmem_dirty_mark();
+/* for writes to pmem which bypass paddr_write(), e.g. DMA or image loading */
+void pmem_dirty_set(paddr_t addr, size_t len);
+size_t pmem_dirty_count(dirty_mark_t since);
+/* call `handler' for each maximal range of pages written since `since' */
+void pmem_dirty_foreach(dirty_mark_t since, dirty_range_handler_t handler, void *arg);
+#else
+static inline void pmem_dirty_set(paddr_t addr, size_t len) {}
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* Atomic accesses to an aligned word, with the atomic instructions of the host
+ * for pmem. They are not atomic for MMIO, but no device relies on that. */
+enum { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
+/* apply `op' with `val' to the word at `addr' and return the old value */
+word_t paddr_amo(paddr_t addr, int op, word_t val);
+/* store `val' only if the word still holds `expected', return whether it is stored */
+bool paddr_cas(paddr_t addr, word_t expected, word_t val);
+
 #endif
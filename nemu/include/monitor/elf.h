@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __MONITOR_ELF_H__
+#define __MONITOR_ELF_H__
+
+#include <common.h>
+
+typedef struct {
+  const char *name;
+  vaddr_t addr;
+  word_t size;
+  bool is_func;
+} ElfSymbol;
+
+bool is_elf_file(const char *file);
+// map the PT_LOAD segments of `file' into pmem, return the size of the image
+// counted from the reset vector and set `*entry' to the entry point
+long load_elf(const char *file, vaddr_t *entry);
+
+// symbol table of the loaded image
+const ElfSymbol* elf_find_symbol(vaddr_t addr);  // the symbol containing `addr'
+const ElfSymbol* elf_lookup_symbol(const char *name);
+
+#endif
@@ -36,7 +36,7 @@ typedef struct
   uint32_t halt_ret;
 } NEMUState;
 
-extern NEMUState nemu_state;
+extern MACHINE_LOCAL NEMUState nemu_state;
 
 // ----------- timer -----------
 
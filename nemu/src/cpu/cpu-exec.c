@@ -18,6 +18,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/intr.h>
+#include <device/replay.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -27,12 +29,16 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
+HART_LOCAL CPU_state cpu = {};
+HART_LOCAL uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+#ifdef CONFIG_SMP
+void smp_exec(uint64_t n);
+uint64_t smp_nr_inst();
+#endif
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -80,15 +86,63 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #endif
 }
 
-static void execute(uint64_t n) {
-  Decode s;
-  for (; n > 0; n--) {
+/* Exceptions raised deep in the memory path unwind straight back to
+ * execute(), so the instructions do not need to check any return code.
+ * The builtin setjmp/longjmp only save the frame and stack pointers, and
+ * do not depend on the libc. */
+static HART_LOCAL void *exec_jbuf[5];
+static HART_LOCAL word_t exception_NO;
+
+void longjmp_exception(word_t NO) {
+  if (nemu_state.state != NEMU_RUNNING) {
+    // e.g. accessing a bad address with the `x' command of sdb
+    panic("exception %d is raised outside of the execution of the guest at pc = " FMT_WORD,
+        (int)NO, cpu.pc);
+  }
+  exception_NO = NO;
+  __builtin_longjmp(exec_jbuf, 1);
+}
+
+static inline void check_intr() {
+  word_t intr = INTR_EMPTY;
+  // a single load and branch unless some device raises its line
+  if (unlikely(dev_intr_pending())) {
+    IFDEF(CONFIG_DIFFTEST_BATCH, if (difftest_replaying) return);
+    intr = isa_query_intr();
+  }
+  IFDEF(CONFIG_REPLAY, intr = replay_intr(intr));
+  if (intr == INTR_EMPTY) return;
+  IFDEF(CONFIG_DIFFTEST, difftest_intr(intr));
+  cpu.pc = isa_raise_intr(intr, cpu.pc);
+}
+
+void execute(uint64_t n) {
+  // nothing here is modified between the setjmp and a longjmp
+  static HART_LOCAL Decode s;
+  // `c' runs with n = -1
+  uint64_t end = (n > UINT64_MAX - g_nr_guest_inst ? UINT64_MAX : g_nr_guest_inst + n);
+  if (__builtin_setjmp(exec_jbuf)) {
+    // the faulting instruction is abandoned
+    cpu.pc = isa_raise_intr(exception_NO, s.pc);
+    IFDEF(CONFIG_ITRACE, snprintf(s.logbuf, sizeof(s.logbuf),
+          FMT_WORD ": exception %d", s.pc, (int)exception_NO));
+    g_nr_guest_inst++;
+    trace_and_difftest(&s, cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING)
+      return;
+    // devices are updated by hart 0 only
+    IFDEF(CONFIG_DEVICE, if (hart_id == 0) device_update());
+    IFDEF(CONFIG_DEVICE, check_intr());
+  }
+  while (g_nr_guest_inst < end) {
     exec_once(&s, cpu.pc);
     g_nr_guest_inst++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING)
       break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    // devices are updated by hart 0 only
+    IFDEF(CONFIG_DEVICE, if (hart_id == 0) device_update());
+    IFDEF(CONFIG_DEVICE, check_intr());
   }
 }
 
@@ -96,10 +150,11 @@ static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
-  Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
+  uint64_t nr_inst = g_nr_guest_inst + MUXDEF(CONFIG_SMP, smp_nr_inst(), 0);
+  Log("total guest instructions = " NUMBERIC_FMT, nr_inst);
   if (g_timer > 0)
     Log("simulation frequency = " NUMBERIC_FMT " inst/s",
-        g_nr_guest_inst * 1000000 / g_timer);
+        nr_inst * 1000000 / g_timer);
   else
     Log("Finish running in less than 1 us and can not calculate the simulation "
         "frequency");
@@ -108,6 +163,8 @@ static void statistic() {
 void assert_fail_msg() {
   isa_reg_display();
   statistic();
+  // the failing instruction is not counted yet
+  IFDEF(CONFIG_SNAPSHOT, snapshot_replay(g_nr_guest_inst + 1));
 }
 
 /* Simulate how the CPU works. */
@@ -125,7 +182,15 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
+#if defined(CONFIG_SMP)
+  smp_exec(n);
+#elif defined(CONFIG_SNAPSHOT)
+  snapshot_exec(n);
+#else
   execute(n);
+#endif
+  IFDEF(CONFIG_DIFFTEST_ASYNC, difftest_async_wait());
+  IFDEF(CONFIG_SNAPSHOT, if (nemu_state.state == NEMU_ABORT) snapshot_replay(g_nr_guest_inst));
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -0,0 +1,193 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+
+/* REF runs in a child process forked after init_difftest(). DUT pushes a
+ * record for each committed instruction into a ring in shared memory, and
+ * the child replays the records on REF and checks them behind DUT. Only the
+ * child calls REF after the fork. A mismatch is reported back with `bad',
+ * and DUT stops at its next instruction, at most RING_SIZE instructions
+ * after the wrong one. The registers displayed by the child are those of
+ * DUT right after the wrong instruction. */
+
+#define RING_SIZE CONFIG_DIFFTEST_ASYNC_RING
+#define RING_MASK (RING_SIZE - 1)
+static_assert((RING_SIZE & RING_MASK) == 0, "DIFFTEST_ASYNC_RING must be a power of 2");
+
+enum { REC_STEP, REC_SKIP, REC_INTR, REC_MEM };
+
+typedef struct {
+  uint32_t type;
+  vaddr_t pc;                       // pc of the instruction, the address for REC_MEM
+  word_t NO;                        // REC_INTR, and the length for REC_MEM
+  uint8_t regs[DIFFTEST_REG_SIZE];  // DUT after the instruction, the data for REC_MEM
+} Record;
+
+typedef struct {
+  // each index on its own cache line, written by one side only
+  uint64_t head __attribute__((aligned(64)));  // by DUT
+  uint64_t tail __attribute__((aligned(64)));  // by REF
+  uint64_t bad  __attribute__((aligned(64)));  // by REF, set on a mismatch
+  vaddr_t bad_pc;
+  Record ring[RING_SIZE] __attribute__((aligned(64)));
+} Channel;
+
+static Channel *ch = NULL;
+static pid_t ref_pid = 0;
+static uint64_t head = 0, tail_seen = 0; // DUT's copies
+
+static void backoff(int *spins) {
+  if (++ *spins < 256) return;
+  if (*spins < 4096) { sched_yield(); return; }
+  // idle, e.g. DUT waits at the prompt of sdb
+  nanosleep(&(struct timespec){ .tv_nsec = 100 * 1000 }, NULL);
+}
+
+static void check_ref_alive() {
+  if (waitpid(ref_pid, NULL, WNOHANG) == ref_pid) {
+    ref_pid = 0;
+    panic("REF process exits unexpectedly");
+  }
+}
+
+static __attribute__((noreturn)) void ref_main() {
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  uint64_t tail = 0, head_seen = 0;
+  CPU_state ref_r;
+  while (true) {
+    int spins = 0;
+    while (tail == head_seen) {
+      head_seen = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+      if (tail == head_seen) backoff(&spins);
+    }
+    for (; tail != head_seen; tail ++) {
+      Record *r = &ch->ring[tail & RING_MASK];
+      switch (r->type) {
+        case REC_STEP:
+          ref_difftest_exec(1);
+          ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+          // isa_difftest_checkregs() compares with `cpu', which only DUT uses in this process
+          memcpy(&cpu, r->regs, DIFFTEST_REG_SIZE);
+          if (!isa_difftest_checkregs(&ref_r, r->pc)) {
+            isa_reg_display();
+            ch->bad_pc = r->pc;
+            __atomic_store_n(&ch->bad, 1, __ATOMIC_RELEASE);
+            fflush(stdout);
+            _exit(0);
+          }
+          break;
+        case REC_SKIP: ref_difftest_regcpy(r->regs, DIFFTEST_TO_REF); break;
+        case REC_INTR: ref_difftest_raise_intr(r->NO); break;
+        case REC_MEM: ref_difftest_memcpy(r->pc, r->regs, r->NO, DIFFTEST_TO_REF); break;
+        default: panic("bad record type %d", r->type);
+      }
+      // let DUT reuse the slots as soon as possible
+      if ((tail & 63) == 0) __atomic_store_n(&ch->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ch->tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
+static inline bool ref_is_bad() {
+  if (likely(!__atomic_load_n(&ch->bad, __ATOMIC_ACQUIRE))) return false;
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = ch->bad_pc;
+  return true;
+}
+
+static inline Record *ring_alloc() {
+  if (unlikely(head - tail_seen == RING_SIZE)) {
+    int spins = 0;
+    while ((tail_seen = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE)) + RING_SIZE == head) {
+      if (ref_is_bad()) return NULL;
+      backoff(&spins);
+      if (spins > 4096) check_ref_alive();
+    }
+  }
+  return &ch->ring[head & RING_MASK];
+}
+
+static inline void ring_push() {
+  head ++;
+  __atomic_store_n(&ch->head, head, __ATOMIC_RELEASE);
+}
+
+void difftest_async_step(vaddr_t pc, bool skip) {
+  if (ref_is_bad()) return;
+  Record *r = ring_alloc();
+  if (r == NULL) return;
+  r->type = (skip ? REC_SKIP : REC_STEP);
+  r->pc = pc;
+  memcpy(r->regs, &cpu, DIFFTEST_REG_SIZE);
+  ring_push();
+}
+
+void difftest_async_intr(word_t NO) {
+  Record *r = ring_alloc();
+  if (r == NULL) return;
+  r->type = REC_INTR;
+  r->NO = NO;
+  ring_push();
+}
+
+// pmem written by a device, the data is carried in pieces of the size of `regs'
+void difftest_async_memcpy(paddr_t addr, size_t len) {
+  while (len > 0) {
+    Record *r = ring_alloc();
+    if (r == NULL) return;
+    size_t n = (len < sizeof(r->regs) ? len : sizeof(r->regs));
+    r->type = REC_MEM;
+    r->pc = addr;
+    r->NO = n;
+    memcpy(r->regs, guest_to_host(addr), n);
+    ring_push();
+    addr += n;
+    len -= n;
+  }
+}
+
+// wait until REF has checked every instruction executed by DUT
+void difftest_async_wait() {
+  int spins = 0;
+  while (__atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE) != head) {
+    if (ref_is_bad()) return;
+    backoff(&spins);
+    if (spins > 4096) check_ref_alive();
+  }
+  ref_is_bad();
+}
+
+void init_difftest_async() {
+  ch = mmap(NULL, sizeof(Channel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  Assert(ch != MAP_FAILED, "mmap() fails for the difftest ring");
+  fflush(stdout);
+  ref_pid = fork();
+  Assert(ref_pid != -1, "fork() fails for the REF process");
+  if (ref_pid == 0) ref_main();
+  Log("REF runs in process %d, with a ring of %d instructions", ref_pid, RING_SIZE);
+}
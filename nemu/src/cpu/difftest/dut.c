@@ -30,10 +30,26 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+static bool is_detach = false;
+#ifdef CONFIG_PMEM_DIRTY
+static dirty_mark_t detach_mark;
+#endif
+
+#ifdef CONFIG_DIFFTEST_BATCH
+static bool batch_flush();
+#endif
+#ifdef CONFIG_DIFFTEST_ASYNC
+void init_difftest_async();
+void difftest_async_step(vaddr_t pc, bool skip);
+void difftest_async_intr(word_t NO);
+void difftest_async_memcpy(paddr_t addr, size_t len);
+#endif
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+  // REF catches up to the instruction before this one
+  IFDEF(CONFIG_DIFFTEST_BATCH, if (!is_skip_ref) batch_flush());
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -59,6 +75,122 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
+#ifdef CONFIG_DIFFTEST_BATCH
+/* DUT and REF run a batch of instructions each before their registers are
+ * compared. `shadow' holds pmem at the start of the batch, and is brought up
+ * to date with the pages written in the last batch when a new one starts. On
+ * a mismatch, both are restored to the start of the batch and re-run for
+ * fewer instructions, to find the first instruction with a different result.
+ * Interrupts and skipped instructions end a batch early, so that a batch
+ * can be re-run without the devices. */
+static CPU_state batch_cpu;        // registers of DUT at the start of the batch
+static uint64_t batch_inst = 0;    // g_nr_guest_inst at the start of the batch
+static uint64_t batch_nr = 0;      // instructions of the batch executed by DUT
+static uint64_t batch_bad_nr = 0;  // if not 0, REF differs after this many instructions
+static bool batch_restart = false; // an interrupt is taken, start a new batch after it
+static dirty_mark_t batch_mark;
+static uint8_t *shadow = NULL;
+bool difftest_replaying = false;
+
+void execute(uint64_t n);
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static void save_page(paddr_t addr, size_t len, void *arg) {
+  memcpy(shadow + (addr - PMEM_LEFT), guest_to_host(addr), len);
+}
+
+static void restore_page(paddr_t addr, size_t len, void *arg) {
+  memcpy(guest_to_host(addr), shadow + (addr - PMEM_LEFT), len);
+}
+
+static void batch_begin() {
+  pmem_dirty_foreach(batch_mark, save_page, NULL);
+  batch_mark = pmem_dirty_mark();
+  batch_cpu = cpu;
+  batch_inst = g_nr_guest_inst;
+  batch_nr = 0;
+  batch_bad_nr = 0;
+}
+
+static void batch_init() {
+  // pages never written are zero in both
+  shadow = calloc(1, CONFIG_MSIZE);
+  assert(shadow);
+  batch_mark = DIRTY_MARK_BOOT;
+  batch_begin();
+}
+
+static bool regs_equal() {
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  return memcmp(&ref_r, &cpu, DIFFTEST_REG_SIZE) == 0;
+}
+
+// let REF run the instructions of the batch executed by DUT, and compare
+static bool batch_flush() {
+  if (batch_bad_nr != 0 || batch_nr == 0) return batch_bad_nr == 0;
+  ref_difftest_exec(batch_nr);
+  if (regs_equal()) { batch_nr = 0; return true; }
+  batch_bad_nr = batch_nr;
+  return false;
+}
+
+// restore both to the start of the batch, and run `n' instructions
+static bool batch_replay(uint64_t n) {
+  pmem_dirty_foreach(batch_mark, restore_page, NULL);
+  cpu = batch_cpu;
+  g_nr_guest_inst = batch_inst;
+  // the pages written by REF are not known
+  ref_difftest_memcpy(PMEM_LEFT, shadow, CONFIG_MSIZE, DIFFTEST_TO_REF);
+  // the CSRs of REF are left at the end of the batch, write them back as well
+  isa_difftest_attach();
+  ref_difftest_regcpy(&batch_cpu, DIFFTEST_TO_REF);
+  nemu_state.state = NEMU_RUNNING;
+  execute(n);
+  ref_difftest_exec(n);
+  return regs_equal();
+}
+
+static void batch_bisect() {
+  // REF matches after `lo' instructions, and differs after `hi'
+  uint64_t lo = 0, hi = batch_bad_nr;
+  Log("difftest: mismatch in the batch of %" PRIu64 " instructions from pc = " FMT_WORD
+      ", searching for the first wrong instruction", hi, batch_cpu.pc);
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  difftest_replaying = true;
+  // the replay starts with the memory of DUT, so a difference already in
+  // the memory of REF, e.g. written by an earlier batch, is lost
+  if (batch_replay(hi)) {
+    difftest_replaying = false;
+    Log("difftest: the mismatch is not reproducible from the batch start, "
+        "REF may have read different memory");
+    // DUT is back to where REF was compared
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = cpu.pc;
+    isa_difftest_checkregs(&ref_r, cpu.pc);
+    isa_reg_display();
+    return;
+  }
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (batch_replay(mid)) lo = mid;
+    else hi = mid;
+  }
+  batch_replay(lo);
+  vaddr_t pc = cpu.pc;
+  execute(1);
+  ref_difftest_exec(1);
+  difftest_replaying = false;
+
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+  isa_difftest_checkregs(&ref_r, pc);
+  isa_reg_display();
+}
+#endif
+
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
@@ -82,13 +214,22 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_difftest_init);
 
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
+#if defined(CONFIG_DIFFTEST_ASYNC)
+  Log("The result of every instruction will be compared with %s in another process.", ref_so_file);
+#elif defined(CONFIG_DIFFTEST_BATCH)
+  Log("The registers will be compared with %s every %d instructions, "
+      "and the first wrong instruction is searched on a mismatch.", ref_so_file, CONFIG_DIFFTEST_BATCH_SIZE);
+#else
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
+#endif
 
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_BATCH, batch_init());
+  IFDEF(CONFIG_DIFFTEST_ASYNC, init_difftest_async());
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -99,9 +240,115 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
+// stop checking, e.g. to run to the region of interest at full speed
+void difftest_detach() {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  Log("difftest: detach is not supported with REF in another process");
+  return;
+#endif
+  if (is_detach) return;
+#ifdef CONFIG_DIFFTEST_BATCH
+  if (!batch_flush()) { batch_bisect(); return; }
+#endif
+  is_detach = true;
+  IFDEF(CONFIG_PMEM_DIRTY, detach_mark = pmem_dirty_mark());
+  Log("difftest: detached");
+}
+
+static void copy_to_ref(paddr_t addr, size_t len, void *arg) {
+  ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+  *(size_t *)arg += len;
+}
+
+// bring REF to the state of DUT, and check again from the next instruction
+void difftest_attach() {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  Log("difftest: attach is not supported with REF in another process");
+  return;
+#endif
+  if (!is_detach) return;
+  is_detach = false;
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+
+  isa_difftest_attach();
+  size_t copied = 0;
+#ifdef CONFIG_PMEM_DIRTY
+  // REF has the same pmem as DUT when detached
+  pmem_dirty_foreach(detach_mark, copy_to_ref, &copied);
+#else
+  copy_to_ref(PMEM_LEFT, CONFIG_MSIZE, &copied);
+#endif
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_BATCH, batch_begin());
+  Log("difftest: attached, %zu KB of pmem copied to REF", copied / 1024);
+}
+
+// called before DUT takes the interrupt `NO'
+void difftest_intr(word_t NO) {
+  if (is_detach) return;
+  IFDEF(CONFIG_DIFFTEST_BATCH, if (batch_flush()) batch_restart = true);
+  IFDEF(CONFIG_DIFFTEST_ASYNC, difftest_async_intr(NO); return);
+  ref_difftest_raise_intr(NO);
+}
+
+// called after a device writes [addr, addr + len) of pmem, e.g. by DMA
+void difftest_dma(paddr_t addr, size_t len) {
+  if (is_detach) return;
+#ifdef CONFIG_DIFFTEST_BATCH
+  if (difftest_replaying) return;
+  // REF catches up, and the data is in the shadow of the next batch
+  if (batch_flush()) batch_begin();
+#endif
+  IFDEF(CONFIG_DIFFTEST_ASYNC, difftest_async_memcpy(addr, len); return);
+  ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+}
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  if (is_detach) return;
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+  difftest_async_step(pc, is_skip_ref);
+  is_skip_ref = false;
+  return;
+#endif
+
+#ifdef CONFIG_DIFFTEST_BATCH
+  if (difftest_replaying) return;
+  batch_nr ++;
+  if (batch_bad_nr != 0) {
+    is_skip_ref = false;
+    batch_restart = false;
+    batch_bisect();
+    return;
+  }
+  if (is_skip_ref) {
+    // REF has caught up in difftest_skip_ref()
+    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    is_skip_ref = false;
+    batch_restart = false;
+    batch_begin();
+    return;
+  }
+  if (batch_restart) {
+    // the batch before the interrupt can not be replayed with it
+    batch_restart = false;
+    ref_difftest_exec(1);
+    if (!regs_equal()) {
+      ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+      checkregs(&ref_r, pc);
+    }
+    batch_begin();
+    return;
+  }
+  if (batch_nr < CONFIG_DIFFTEST_BATCH_SIZE && nemu_state.state == NEMU_RUNNING) return;
+  if (batch_flush()) batch_begin();
+  else batch_bisect();
+  return;
+#endif
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
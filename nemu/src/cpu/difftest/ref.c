@@ -18,20 +18,32 @@
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
+/* REF side of the difftest API, built with TARGET_SHARE. REF has no
+ * devices and no tracer, so difftest_exec() is the plain interpreter loop. */
+
+void execute(uint64_t n);
+
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  Assert(in_pmem(addr) && (n == 0 || in_pmem(addr + n - 1)),
+      "[" FMT_PADDR ", " FMT_PADDR ") is out of pmem", addr, (paddr_t)(addr + n));
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  // only the GPRs and pc, laid out at the start of CPU_state
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  // DUT may go on after the guest has hit the trap of NEMU
+  nemu_state.state = NEMU_RUNNING;
+  execute(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
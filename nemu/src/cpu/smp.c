@@ -0,0 +1,139 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <pthread.h>
+
+/* Harts 1 to NR_HART - 1 run in their own threads, and hart 0 runs in the
+ * thread of the monitor, so that sdb still sees hart 0 in `cpu'. The helper
+ * threads are parked while NEMU is stopped, and cpu_exec() only returns after
+ * all of them are parked again. */
+
+void execute(uint64_t n);
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+__thread int hart_id = 0;
+
+static CPU_state boot_cpu;
+static uint64_t nr_inst[NR_HART] = {};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static uint64_t run_gen = 0; // bumped to start a run
+static int nr_parked = 0;
+
+#ifdef CONFIG_SMP_QUANTUM
+/* The harts take turns in the order of their ids, and only the hart holding
+ * the turn runs. This makes a run reproducible, and the devices are only
+ * accessed by one hart at a time. */
+static int turn = 0;
+
+static bool wait_turn() {
+  pthread_mutex_lock(&lock);
+  while (turn != hart_id && nemu_state.state == NEMU_RUNNING) {
+    pthread_cond_wait(&cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+  return nemu_state.state == NEMU_RUNNING;
+}
+
+static void pass_turn() {
+  pthread_mutex_lock(&lock);
+  turn = (hart_id + 1) % NR_HART;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+static void run_hart(uint64_t n) {
+  while (n > 0 && wait_turn()) {
+    uint64_t q = (n < CONFIG_SMP_QUANTUM_SIZE ? n : CONFIG_SMP_QUANTUM_SIZE);
+    execute(q);
+    n -= q;
+    // keep the turn at the end of a run, so the next one resumes from here
+    if (n > 0) pass_turn();
+  }
+}
+#else
+static void run_hart(uint64_t n) {
+  execute(n);
+}
+#endif
+
+static void* hart_thread(void *arg) {
+  hart_id = (intptr_t)arg;
+  cpu = boot_cpu;
+  isa_init_hart(hart_id);
+
+  uint64_t gen = 0;
+  pthread_mutex_lock(&lock);
+  while (true) {
+    nr_inst[hart_id] = g_nr_guest_inst;
+    nr_parked ++;
+    pthread_cond_broadcast(&cond);
+    while (run_gen == gen) pthread_cond_wait(&cond, &lock);
+    gen = run_gen;
+    nr_parked --;
+    pthread_mutex_unlock(&lock);
+
+    // run until hart 0 stops the others
+    run_hart(-1);
+
+    pthread_mutex_lock(&lock);
+  }
+  return NULL;
+}
+
+void smp_exec(uint64_t n) {
+  pthread_mutex_lock(&lock);
+  IFDEF(CONFIG_SMP_QUANTUM, turn = 0);
+  run_gen ++;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+
+  run_hart(n);
+
+  // stop the other harts, which check the state after each instruction
+  pthread_mutex_lock(&lock);
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+  pthread_cond_broadcast(&cond);
+  while (nr_parked < NR_HART - 1) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+// instructions executed by the other harts
+uint64_t smp_nr_inst() {
+  uint64_t n = 0;
+  for (int i = 1; i < NR_HART; i ++) n += nr_inst[i];
+  return n;
+}
+
+void init_smp() {
+  // the other harts start from the reset state of hart 0
+  boot_cpu = cpu;
+  isa_init_hart(0);
+  for (intptr_t i = 1; i < NR_HART; i ++) {
+    pthread_t t;
+    int ret = pthread_create(&t, NULL, hart_thread, (void *)i);
+    Assert(ret == 0, "Can not create the thread of hart %d", (int)i);
+  }
+
+  pthread_mutex_lock(&lock);
+  while (nr_parked < NR_HART - 1) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+  Log("%d harts, %s", NR_HART, MUXDEF(CONFIG_SMP_QUANTUM,
+      "quantum of " str(CONFIG_SMP_QUANTUM_SIZE) " instructions", "free-running"));
+}
@@ -0,0 +1,123 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <isa.h>
+#include <cpu/cpu.h>
+
+/* Every CONFIG_SNAPSHOT_INTERVAL instructions, NEMU forks a copy of itself,
+ * which shares all the memory copy-on-write and sleeps on a pipe. The last
+ * two are kept. When NEMU aborts, the newest one taken before the failing
+ * instruction is woken up. It runs up to that instruction again, and the
+ * tracer logs every instruction. With in-process difftest, REF is forked
+ * along with it, so the failure is found again by difftest. */
+
+#define NR_SNAPSHOT 2
+
+typedef struct {
+  pid_t pid;       // 0 if unused
+  int fd;          // write end of the pipe the snapshot sleeps on
+  uint64_t nr_inst;
+} Snapshot;
+
+static Snapshot snaps[NR_SNAPSHOT] = {}; // the newest first
+static uint64_t next_snapshot = CONFIG_SNAPSHOT_INTERVAL;
+bool snapshot_replaying = false;
+
+void execute(uint64_t n);
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static void snapshot_drop(Snapshot *s) {
+  if (s->pid == 0) return;
+  close(s->fd);
+  kill(s->pid, SIGKILL);
+  waitpid(s->pid, NULL, 0);
+  s->pid = 0;
+}
+
+static __attribute__((noreturn)) void snapshot_sleep(int fd) {
+  uint64_t target;
+  // EOF when NEMU exits or drops this snapshot
+  if (read(fd, &target, sizeof(target)) != sizeof(target)) _exit(0);
+
+  Log("snapshot: run instructions %" PRIu64 " to %" PRIu64 " again with tracing",
+      g_nr_guest_inst + 1, target);
+  snapshot_replaying = true;
+  nemu_state.state = NEMU_RUNNING;
+  execute(target - g_nr_guest_inst);
+  Log("snapshot: stop at pc = " FMT_WORD " after instruction %" PRIu64,
+      cpu.pc, g_nr_guest_inst);
+  fflush(NULL);
+  _exit(0);
+}
+
+static void snapshot_take() {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    Log("snapshot: pipe() fails, no snapshot at instruction %" PRIu64, g_nr_guest_inst);
+    return;
+  }
+  // or the buffered output is written twice
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[1]);
+    for (int i = 0; i < NR_SNAPSHOT; i ++) {
+      if (snaps[i].pid != 0) close(snaps[i].fd);
+    }
+    snapshot_sleep(fds[0]);
+  }
+  close(fds[0]);
+  if (pid == -1) {
+    close(fds[1]);
+    Log("snapshot: fork() fails, no snapshot at instruction %" PRIu64, g_nr_guest_inst);
+    return;
+  }
+  snapshot_drop(&snaps[NR_SNAPSHOT - 1]);
+  memmove(&snaps[1], &snaps[0], sizeof(snaps[0]) * (NR_SNAPSHOT - 1));
+  snaps[0] = (Snapshot){ .pid = pid, .fd = fds[1], .nr_inst = g_nr_guest_inst };
+}
+
+void snapshot_exec(uint64_t n) {
+  uint64_t end = (n > UINT64_MAX - g_nr_guest_inst ? UINT64_MAX : g_nr_guest_inst + n);
+  while (g_nr_guest_inst < end && nemu_state.state == NEMU_RUNNING) {
+    if (g_nr_guest_inst >= next_snapshot) {
+      snapshot_take();
+      next_snapshot = g_nr_guest_inst + CONFIG_SNAPSHOT_INTERVAL;
+    }
+    execute((end < next_snapshot ? end : next_snapshot) - g_nr_guest_inst);
+  }
+}
+
+// wake up a snapshot to run up to the `target'-th instruction, and wait for it
+void snapshot_replay(uint64_t target) {
+  if (snapshot_replaying) return;
+  for (int i = 0; i < NR_SNAPSHOT; i ++) {
+    Snapshot *s = &snaps[i];
+    if (s->pid == 0 || s->nr_inst >= target) continue;
+    Log("snapshot: wake up the one taken at instruction %" PRIu64, s->nr_inst);
+    fflush(NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if (write(s->fd, &target, sizeof(target)) == sizeof(target)) waitpid(s->pid, NULL, 0);
+    close(s->fd);
+    s->pid = 0;
+    return;
+  }
+  Log("snapshot: none is taken before instruction %" PRIu64, target);
+}
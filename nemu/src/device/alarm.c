@@ -15,37 +15,59 @@
 
 #include <common.h>
 #include <device/alarm.h>
-#include <sys/time.h>
-#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #define MAX_HANDLER 8
 
 static alarm_handler_t handler[MAX_HANDLER] = {};
 static int idx = 0;
 
+/* The timer thread only sets this word. The handlers are run by the CPU
+ * thread when it polls the word, so they may safely touch any state of
+ * NEMU, and no signal interrupts the syscalls of readline or SDL. */
+static atomic_bool alarm_pending = false;
+
 void add_alarm_handle(alarm_handler_t h) {
   assert(idx < MAX_HANDLER);
   handler[idx ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
+bool alarm_poll() {
+  if (likely(!atomic_load_explicit(&alarm_pending, memory_order_relaxed))) return false;
+  atomic_store_explicit(&alarm_pending, false, memory_order_relaxed);
+  return true;
+}
+
+void alarm_run() {
   int i;
   for (i = 0; i < idx; i ++) {
     handler[i]();
   }
 }
 
-void init_alarm() {
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = alarm_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  struct itimerval it = {};
+static void* alarm_thread(void *arg) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  Assert(fd != -1, "Can not create timerfd");
+  struct itimerspec it = {};
   it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
+  it.it_value.tv_nsec = 1000000000 / TIMER_HZ;
   it.it_interval = it.it_value;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  int ret = timerfd_settime(fd, 0, &it, NULL);
   Assert(ret == 0, "Can not set timer");
+
+  uint64_t nr_expire;
+  while (read(fd, &nr_expire, sizeof(nr_expire)) == sizeof(nr_expire)) {
+    // ticks missed while the CPU thread is busy are merged into one
+    atomic_store_explicit(&alarm_pending, true, memory_order_relaxed);
+  }
+  return NULL;
+}
+
+void init_alarm() {
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, alarm_thread, NULL);
+  Assert(ret == 0, "Can not create the timer thread");
 }
@@ -15,7 +15,9 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/replay.h>
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 enum {
   reg_freq,
@@ -30,7 +32,72 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/* `sbuf' is a ring buffer with a single producer, the guest, and a single
+ * consumer, the SDL audio callback. The guest appends data after the bytes
+ * still queued, then adds its length to `reg_count'. The callback consumes
+ * data from `sbuf_head'. `count' is the only shared variable. */
+static _Atomic uint32_t count = 0;
+static uint32_t sbuf_head = 0;         // used by the callback only
+static uint32_t count_read_by_guest = 0;
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t nr = atomic_load_explicit(&count, memory_order_acquire);
+  if (nr > len) nr = len;
+  uint32_t first = CONFIG_SB_SIZE - sbuf_head;
+  if (first > nr) first = nr;
+  memcpy(stream, sbuf + sbuf_head, first);
+  memcpy(stream + first, sbuf, nr - first);
+  sbuf_head = (sbuf_head + nr) % CONFIG_SB_SIZE;
+  atomic_fetch_sub_explicit(&count, nr, memory_order_release);
+  // play silence if the guest is late
+  if (len > nr) memset(stream + nr, 0, len - nr);
+}
+
+static void audio_init() {
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  s.userdata = NULL;
+
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  int ret = SDL_OpenAudio(&s, NULL);
+  if (ret != 0) {
+    Log("Can not open audio: %s", SDL_GetError());
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4);
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) {
+        audio_init();
+        audio_base[reg_init] = 0;
+      }
+      break;
+    case reg_count:
+      if (!is_write) {
+        count_read_by_guest = replay_input(REPLAY_AUDIO, atomic_load_explicit(&count, memory_order_relaxed));
+        audio_base[reg_count] = count_read_by_guest;
+      } else {
+        /* The guest writes back the count it read plus the length of the new
+         * data, but the callback may have consumed some data in between.
+         * Only the difference is added, so that no update is lost. */
+        atomic_fetch_add_explicit(&count, audio_base[reg_count] - count_read_by_guest,
+            memory_order_release);
+        count_read_by_guest = audio_base[reg_count];
+      }
+      break;
+    case reg_sbuf_size:
+      assert(!is_write);
+      break;
+    default: break;
+  }
 }
 
 void init_audio() {
@@ -42,6 +109,7 @@ void init_audio() {
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
 
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
 }
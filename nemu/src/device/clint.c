@@ -0,0 +1,105 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <utils.h>
+#include <device/map.h>
+#include <device/intr.h>
+#include <device/replay.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* Core-local interruptor with one msip and mtimecmp per hart, in the layout
+ * of the SiFive CLINT.
+ * https://github.com/riscv/riscv-aclint/blob/main/riscv-aclint.adoc */
+#define MSIP_OFFSET     0x0
+#define MTIMECMP_OFFSET 0x4000
+#define MTIME_OFFSET    0xbff8
+#define CLINT_SIZE      0xc000
+
+static uint8_t *clint_base = NULL;
+#define msip     ((uint32_t *)(clint_base + MSIP_OFFSET))
+#define mtimecmp ((uint64_t *)(clint_base + MTIMECMP_OFFSET))
+#define mtime    ((uint64_t *)(clint_base + MTIME_OFFSET))
+
+/* mtime ticks at 1 MHz. It is not ticked by the CPU loop, but computed from
+ * the host time when it is read. A write to mtime only changes the delta. */
+static uint64_t mtime_delta = 0;
+
+static uint64_t get_mtime() {
+  return get_time() + mtime_delta;
+}
+
+/* The timer thread only sleeps on a timerfd armed for the earliest mtimecmp,
+ * and raises INTR_LINE_CLINT of hart 0 when it expires. mtime is compared
+ * with mtimecmp here, in the CPU thread, so a stale expiry never raises MTIP. */
+static int timer_fd = -1;
+
+void clint_update() {
+  uint64_t now = get_mtime();
+  uint64_t next = UINT64_MAX;
+  for (int h = 0; h < NR_HART; h ++) {
+    uint64_t cmp = mtimecmp[h];
+    dev_set_intr(h, INTR_LINE_MTIP, now >= cmp);
+    if (now < cmp && cmp < next) next = cmp;
+  }
+  // a zero value disarms the timer
+  struct itimerspec it = {};
+  if (next != UINT64_MAX) {
+    uint64_t us = next - now;
+    it.it_value.tv_sec = us / 1000000;
+    it.it_value.tv_nsec = us % 1000000 * 1000;
+  }
+  int ret = timerfd_settime(timer_fd, 0, &it, NULL);
+  Assert(ret == 0, "Can not set the timer of CLINT");
+}
+
+static void* clint_timer_thread(void *arg) {
+  uint64_t nr_expire;
+  while (read(timer_fd, &nr_expire, sizeof(nr_expire)) == sizeof(nr_expire)) {
+    dev_set_intr(0, INTR_LINE_CLINT, true);
+  }
+  return NULL;
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= MTIME_OFFSET) {
+    if (!is_write) { *mtime = replay_input(REPLAY_MTIME, get_mtime()); return; }
+    mtime_delta = *mtime - get_time();
+    clint_update();
+  } else if (offset >= MTIMECMP_OFFSET) {
+    if (is_write) clint_update();
+  } else if (is_write && offset < NR_HART * 4) {
+    // an inter-processor interrupt when written by another hart
+    int h = offset / 4;
+    msip[h] &= 1;
+    dev_set_intr(h, INTR_LINE_MSIP, msip[h]);
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  for (int h = 0; h < NR_HART; h ++) {
+    msip[h] = 0;
+    mtimecmp[h] = UINT64_MAX;
+  }
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  Assert(timer_fd != -1, "Can not create timerfd");
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, clint_timer_thread, NULL);
+  Assert(ret == 0, "Can not create the timer thread of CLINT");
+}
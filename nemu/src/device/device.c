@@ -16,9 +16,13 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/map.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
+#ifdef CONFIG_SMP
+#include <pthread.h>
+#endif
 
 void init_map();
 void init_serial();
@@ -28,46 +32,83 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_clint();
+void init_plic();
+void init_virtio_blk();
+void init_virtio_console();
 void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void serial_flush();
+
+#ifdef CONFIG_SMP
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void device_lock() { pthread_mutex_lock(&dev_lock); }
+void device_unlock() { pthread_mutex_unlock(&dev_lock); }
+#endif
+
+#ifndef CONFIG_TARGET_AM
+// set by the thread polling SDL events, which may not be the CPU thread
+static volatile bool quit_requested = false;
+
+void sdl_handle_event(SDL_Event *event) {
+  switch (event->type) {
+    case SDL_QUIT:
+      quit_requested = true;
+      break;
+#ifdef CONFIG_HAS_KEYBOARD
+    // If a key was pressed
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+      uint8_t k = event->key.keysym.scancode;
+      bool is_keydown = (event->key.type == SDL_KEYDOWN);
+      send_key(k, is_keydown);
+      break;
+    }
+#endif
+    default: break;
+  }
+}
+#endif
 
 void device_update() {
+#ifdef CONFIG_TARGET_AM
   static uint64_t last = 0;
   uint64_t now = get_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
+#else
+  // a single load in the common case
+  if (!alarm_poll()) return;
+#endif
 
+  // the other harts may be accessing the devices
+  device_lock();
+  IFNDEF(CONFIG_TARGET_AM, alarm_run());
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+  device_unlock();
 
 #ifndef CONFIG_TARGET_AM
+#ifndef CONFIG_VGA_RENDER_THREAD
+  // otherwise events are polled by the render thread
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
-#ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
+    sdl_handle_event(&event);
+  }
 #endif
-      default: break;
-    }
+  if (quit_requested) {
+    nemu_state.state = NEMU_QUIT;
   }
 #endif
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_VGA_RENDER_THREAD)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -84,6 +125,10 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
+  IFDEF(CONFIG_HAS_VIRTIO, init_virtio_blk());
+  IFDEF(CONFIG_HAS_VIRTIO, init_virtio_console());
 
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
 }
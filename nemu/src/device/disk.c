@@ -14,6 +14,88 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLKSZ 512
+
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,    // guest physical address of the buffer
+  reg_blkno,
+  reg_nblk,   // number of blocks to transfer
+  reg_cmd,    // writing it starts the transfer
+  nr_reg
+};
+
+enum { CMD_READ, CMD_WRITE };
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;  // the image is mapped, and written back by the kernel
+static uint32_t nr_blk = 0;
+
+// the whole request is a single copy between the image and pmem
+static void disk_transfer() {
+  paddr_t buf = disk_base[reg_buf];
+  uint32_t blkno = disk_base[reg_blkno];
+  uint32_t n = disk_base[reg_nblk];
+  size_t len = (size_t)n * BLKSZ;
+  if (n == 0) return;
+  Assert(blkno < nr_blk && n <= nr_blk - blkno, "disk: blocks [%u, %u) are out of bound of the image with %u blocks",
+      blkno, blkno + n, nr_blk);
+  Assert(in_pmem(buf) && in_pmem(buf + len - 1), "disk: buffer [" FMT_PADDR ", " FMT_PADDR ") is out of pmem",
+      buf, (paddr_t)(buf + len));
+  pmem_populate(buf, len);
+  if (disk_base[reg_cmd] == CMD_WRITE) {
+    memcpy(img + (size_t)blkno * BLKSZ, guest_to_host(buf), len);
+  } else {
+    memcpy(guest_to_host(buf), img + (size_t)blkno * BLKSZ, len);
+    dev_pmem_written(buf, len);
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    disk_transfer();
+  }
+}
+
+static void init_disk_img() {
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] == '\0') return;
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    Log("Can not open disk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  nr_blk = st.st_size / BLKSZ;
+  if (nr_blk > 0) {
+    img = mmap(NULL, (size_t)nr_blk * BLKSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map disk image %s", path);
+  }
+  close(fd);
+  Log("Disk image %s with %u blocks", path, nr_blk);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  init_disk_img();
+  disk_base[reg_present] = (img != NULL);
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = nr_blk;
 }
@@ -14,6 +14,42 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
+#include <device/map.h>
+
+uint32_t dev_intr_lines[NR_HART] = {};
+uint32_t dev_intr_enabled[NR_HART] = { [0 ... NR_HART - 1] = ~0u };
+
+void dev_set_intr(int hart, uint32_t line, bool level) {
+  uint32_t *lines = &dev_intr_lines[hart];
+#ifdef CONFIG_TARGET_AM
+  // no other thread, and the host may not have atomic instructions
+  if (level) *lines |= line;
+  else *lines &= ~line;
+#else
+  // the timer thread of the CLINT and the other harts also raise lines
+  if (level) __atomic_fetch_or(lines, line, __ATOMIC_RELAXED);
+  else __atomic_fetch_and(lines, ~line, __ATOMIC_RELAXED);
+#endif
+}
+
+uint32_t dev_query_intr() {
+  uint32_t *p = &dev_intr_lines[hart_id];
+  uint32_t lines = __atomic_load_n(p, __ATOMIC_RELAXED);
+#ifdef CONFIG_HAS_CLINT
+  // only raised on hart 0, which updates the timers of all harts
+  if (lines & INTR_LINE_CLINT) {
+    void clint_update();
+    dev_set_intr(hart_id, INTR_LINE_CLINT, false);
+    device_lock();
+    clint_update();
+    device_unlock();
+    lines = __atomic_load_n(p, __ATOMIC_RELAXED);
+  }
+#endif
+  return lines & ~INTR_LINE_CLINT;
+}
 
 void dev_raise_intr() {
+  dev_set_intr(0, INTR_LINE_TIMER, true);
 }
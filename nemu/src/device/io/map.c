@@ -56,8 +56,10 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  device_lock();
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  device_unlock();
   return ret;
 }
 
@@ -65,6 +67,8 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  device_lock();
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  device_unlock();
 }
@@ -13,8 +13,10 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <isa.h>
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
 
 #define NR_MAP 16
 
@@ -55,9 +57,13 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
 
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  IFDEF(CONFIG_MEM_ACCESS_FAULT, if (map == NULL) longjmp_exception(isa_access_fault_no(MEM_TYPE_READ)));
+  return map_read(addr, len, map);
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  IFDEF(CONFIG_MEM_ACCESS_FAULT, if (map == NULL) longjmp_exception(isa_access_fault_no(MEM_TYPE_WRITE)));
+  map_write(addr, len, data, map);
 }
@@ -14,12 +14,14 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/replay.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
 
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 // Note that this is not the standard
 #define NEMU_KEYS(f) \
@@ -45,21 +47,27 @@ static void init_keymap() {
   MAP(NEMU_KEYS, SDL_KEYMAP)
 }
 
+/* A single-producer single-consumer queue. Keys may be sent by the render
+ * thread while the CPU thread reads them, so the indices are atomic and each
+ * is only written by one side. */
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+static _Atomic int key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  int r = atomic_load_explicit(&key_r, memory_order_relaxed);
+  int next = (r + 1) % KEY_QUEUE_LEN;
+  Assert(next != atomic_load_explicit(&key_f, memory_order_acquire), "key queue overflow!");
+  key_queue[r] = am_scancode;
+  atomic_store_explicit(&key_r, next, memory_order_release);
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  int f = atomic_load_explicit(&key_f, memory_order_relaxed);
+  if (f != atomic_load_explicit(&key_r, memory_order_acquire)) {
+    key = key_queue[f];
+    atomic_store_explicit(&key_f, (f + 1) % KEY_QUEUE_LEN, memory_order_release);
   }
   return key;
 }
@@ -85,7 +93,7 @@ static uint32_t *i8042_data_port_base = NULL;
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
-  i8042_data_port_base[0] = key_dequeue();
+  i8042_data_port_base[0] = replay_input(REPLAY_KEY, key_dequeue());
 }
 
 void init_i8042() {
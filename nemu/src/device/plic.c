@@ -0,0 +1,96 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/intr.h>
+
+/* Platform-level interrupt controller with a single context (M-mode of
+ * hart 0), in the layout of the SiFive PLIC.
+ * https://github.com/riscv/riscv-plic-spec/blob/master/riscv-plic.adoc */
+#define NR_SRC 32 // source 0 does not exist
+#define PRIORITY_OFFSET  0x0
+#define PENDING_OFFSET   0x1000
+#define ENABLE_OFFSET    0x2000
+#define THRESHOLD_OFFSET 0x200000
+#define CLAIM_OFFSET     0x200004
+#define PLIC_SIZE        0x200008
+
+static uint32_t *plic_base = NULL;
+#define priority  (plic_base + PRIORITY_OFFSET / 4)
+#define pending   (plic_base[PENDING_OFFSET / 4])
+#define enable    (plic_base[ENABLE_OFFSET / 4])
+#define threshold (plic_base[THRESHOLD_OFFSET / 4])
+#define claim     (plic_base[CLAIM_OFFSET / 4])
+
+static uint32_t level = 0;   // levels of the interrupt sources
+static uint32_t claimed = 0; // claimed but not completed yet
+static uint32_t gateway = 0; // pending bits, the register is read-only to the guest
+
+// the pending and enabled source with the highest priority, 0 if none
+static int plic_best() {
+  uint32_t p = gateway & enable;
+  int best = 0;
+  uint32_t max = threshold;
+  for (int i = 1; i < NR_SRC; i ++) {
+    if ((p & (1u << i)) && priority[i] > max) { best = i; max = priority[i]; }
+  }
+  return best;
+}
+
+static void plic_update() {
+  dev_set_intr(0, INTR_LINE_MEIP, plic_best() != 0);
+}
+
+/* device interface, the source is pending until it is claimed */
+void plic_set_irq(int src, bool lvl) {
+  assert(src > 0 && src < NR_SRC);
+  uint32_t mask = 1u << src;
+  if (lvl) {
+    level |= mask;
+    if (!(claimed & mask)) gateway |= mask;
+  } else {
+    level &= ~mask;
+  }
+  plic_update();
+}
+
+static void plic_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset == CLAIM_OFFSET) {
+    if (!is_write) {
+      int src = plic_best();
+      if (src != 0) {
+        gateway &= ~(1u << src);
+        claimed |= 1u << src;
+      }
+      claim = src;
+    } else if (claim > 0 && claim < NR_SRC) {
+      // complete, a source still asserted is pending again
+      uint32_t mask = 1u << claim;
+      claimed &= ~mask;
+      if (level & mask) gateway |= mask;
+    }
+  } else if (offset == PENDING_OFFSET) {
+    pending = gateway;
+    return;
+  }
+  plic_update();
+}
+
+void init_plic() {
+  // too large for new_space(), and most of it is never touched
+  plic_base = calloc(PLIC_SIZE, 1);
+  assert(plic_base);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, plic_base, PLIC_SIZE, plic_io_handler);
+}
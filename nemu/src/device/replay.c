@@ -0,0 +1,133 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/replay.h>
+
+/* The log starts with MAGIC. Each input is a type byte, then the number of
+ * instructions since the previous input and the value, both as LEB128
+ * varints, so most inputs take a few bytes. */
+#define MAGIC "NEMURPL1"
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+int replay_mode = REPLAY_OFF;
+static FILE *fp = NULL;
+static uint64_t last_inst = 0;
+
+// the next input in the log when replaying
+static struct {
+  int type; // -1 at the end of the log
+  uint64_t inst;
+  uint64_t val;
+} next = { .type = -1 };
+
+static const char *type_name[NR_REPLAY] = {
+  [REPLAY_KEY] = "key", [REPLAY_RTC] = "rtc", [REPLAY_SERIAL] = "serial",
+  [REPLAY_AUDIO] = "audio", [REPLAY_MTIME] = "mtime", [REPLAY_INTR] = "intr",
+};
+
+static void put_varint(uint64_t x) {
+  do {
+    uint8_t b = x & 0x7f;
+    x >>= 7;
+    fputc(b | (x ? 0x80 : 0), fp);
+  } while (x);
+}
+
+static bool get_varint(uint64_t *x) {
+  *x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int b = fgetc(fp);
+    if (b == EOF) return false;
+    *x |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static void record(int type, uint64_t val) {
+  fputc(type, fp);
+  put_varint(g_nr_guest_inst - last_inst);
+  put_varint(val);
+  last_inst = g_nr_guest_inst;
+}
+
+static void fetch_next() {
+  uint64_t delta;
+  int type = fgetc(fp);
+  if (type == EOF || type >= NR_REPLAY || !get_varint(&delta) || !get_varint(&next.val)) {
+    next.type = -1;
+    replay_mode = REPLAY_OFF;
+    Log("Replay finished at instruction %" PRIu64 ", inputs are live from now on", g_nr_guest_inst);
+    return;
+  }
+  next.type = type;
+  next.inst = last_inst + delta;
+  last_inst = next.inst;
+}
+
+uint64_t replay_input(int type, uint64_t val) {
+  // inputs read by sdb are not from the guest
+  if (replay_mode == REPLAY_OFF || nemu_state.state != NEMU_RUNNING) return val;
+  if (replay_mode == REPLAY_RECORD) {
+    record(type, val);
+    return val;
+  }
+  Assert(next.type == type && next.inst == g_nr_guest_inst,
+      "replay diverged at instruction %" PRIu64 ": reading %s, but the log has %s at instruction %" PRIu64,
+      g_nr_guest_inst, type_name[type], type_name[next.type], next.inst);
+  uint64_t ret = next.val;
+  fetch_next();
+  return ret;
+}
+
+word_t replay_intr_slow(word_t intr) {
+  if (replay_mode == REPLAY_RECORD) {
+    if (intr != INTR_EMPTY) record(REPLAY_INTR, intr);
+    return intr;
+  }
+  Assert(next.inst >= g_nr_guest_inst, "replay diverged at instruction %" PRIu64 ": %s at instruction %" PRIu64 " is not read",
+      g_nr_guest_inst, type_name[next.type], next.inst);
+  if (next.type != REPLAY_INTR || next.inst != g_nr_guest_inst) return INTR_EMPTY;
+  word_t ret = next.val;
+  fetch_next();
+  return ret;
+}
+
+static void close_log() {
+  fclose(fp);
+}
+
+void init_replay(const char *record_file, const char *replay_file) {
+  Assert(!(record_file && replay_file), "can not record and replay at the same time");
+  if (record_file) {
+    fp = fopen(record_file, "wb");
+    Assert(fp, "Can not open '%s'", record_file);
+    fputs(MAGIC, fp);
+    replay_mode = REPLAY_RECORD;
+    atexit(close_log);
+    Log("Recording inputs to %s", record_file);
+  } else if (replay_file) {
+    fp = fopen(replay_file, "rb");
+    Assert(fp, "Can not open '%s'", replay_file);
+    char magic[sizeof(MAGIC) - 1];
+    Assert(fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, MAGIC, sizeof(magic)) == 0,
+        "'%s' is not a log of inputs", replay_file);
+    replay_mode = REPLAY_PLAY;
+    Log("Replaying inputs from %s", replay_file);
+    fetch_next();
+  }
+}
@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,31 +33,66 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
+// No IRQ is supported, so the driver must be modified to start PIO
 // right after sending the actual read/write commands.
+// As an extension, if SDDMA is set to a guest physical address before a
+// multiple block command, all `blkcnt' blocks are transferred by the command
+// itself, and SDDMA is cleared. The unmodified driver never touches SDDMA.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
   SDRSP0, SDRSP1, SDRSP2, SDRSP3,
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
-  SDDATA, __PAD10, __PAD11, __PAD12,
+  SDDATA, SDDMA, __PAD11, __PAD12,
   SDHBLC
 };
 
-static FILE *fp = NULL;
+// the image is mapped, and the part of the card beyond it reads as zero
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+static void dma_rw() {
+  paddr_t buf = base[SDDMA];
+  uint64_t pos = blk_addr << 9;
+  uint64_t len = (uint64_t)blkcnt << 9;
+  base[SDDMA] = 0;
+  Assert(in_pmem(buf) && in_pmem(buf + len - 1), "sdcard: DMA buffer [" FMT_PADDR ", " FMT_PADDR ") is out of pmem",
+      buf, (paddr_t)(buf + len));
+  uint64_t n = (pos >= img_size ? 0 : (len < img_size - pos ? len : img_size - pos));
+  pmem_populate(buf, len);
+  uint8_t *p = guest_to_host(buf);
+  if (write_cmd) {
+    memcpy(img + pos, p, n);
+  } else {
+    memcpy(p, img + pos, n);
+    memset(p + n, 0, len - n);
+    dev_pmem_written(buf, len);
+  }
+  addr = len;
+}
+
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  if (base[SDDMA] != 0 && blkcnt != 0) dma_rw();
+}
+
+static void pio_rw() {
+  uint64_t pos = (blk_addr << 9) + addr;
+  if (pos + 4 > img_size) {
+    if (!write_cmd) base[SDDATA] = 0;
+    return;
+  }
+  if (!write_cmd) { memcpy(&base[SDDATA], img + pos, 4); }
+  else { memcpy(img + pos, &base[SDDATA], 4); }
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -109,13 +149,12 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else {
+         pio_rw();
        }
        addr += 4;
        break;
+    case SDDMA: break;
     default:
       Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
       panic("unhandle offset = %d", offset);
@@ -128,7 +167,19 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map sdcard image %s", path);
+  }
+  close(fd);
 }
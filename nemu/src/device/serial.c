@@ -15,18 +15,108 @@
 
 #include <utils.h>
 #include <device/map.h>
+#include <device/replay.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
 #define CH_OFFSET 0
+#define LSR_OFFSET 5
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+#include <unistd.h>
+
+/* stderr is unbuffered, so the output is buffered here and written out on
+ * newline, when the buffer is full, by serial_flush() at TIMER_HZ and at exit. */
+static char obuf[4096];
+static int olen = 0;
+
+void serial_flush() {
+  if (olen > 0) {
+    __attribute__((unused)) ssize_t ret = write(STDERR_FILENO, obuf, olen);
+    olen = 0;
+  }
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  obuf[olen ++] = ch;
+  if (ch == '\n' || olen == sizeof(obuf)) serial_flush();
 }
+#else
+void serial_flush() {}
+
+static void serial_putc(char ch) {
+  putch(ch);
+}
+#endif
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#define FIFO_PATH "/tmp/nemu.serial"
+
+/* Bytes from FIFO_PATH are read by a background thread into a single-producer
+ * single-consumer queue, so the guest never waits for the host. */
+#define QUEUE_LEN 1024
+static uint8_t queue[QUEUE_LEN];
+static _Atomic uint32_t q_head = 0, q_tail = 0;
+
+static bool serial_has_input() {
+  return atomic_load_explicit(&q_head, memory_order_relaxed) !=
+    atomic_load_explicit(&q_tail, memory_order_acquire);
+}
+
+static uint8_t serial_getc() {
+  if (!serial_has_input()) return 0xff;
+  uint32_t h = atomic_load_explicit(&q_head, memory_order_relaxed);
+  uint8_t ch = queue[h];
+  atomic_store_explicit(&q_head, (h + 1) % QUEUE_LEN, memory_order_release);
+  return ch;
+}
+
+static void* serial_input_thread(void *arg) {
+  while (true) {
+    // blocks until there is a writer, and reopens after the writer closes
+    int fd = open(FIFO_PATH, O_RDONLY);
+    if (fd == -1) { sleep(1); continue; }
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t i = 0; i < n; i ++) {
+        uint32_t t = atomic_load_explicit(&q_tail, memory_order_relaxed);
+        uint32_t next = (t + 1) % QUEUE_LEN;
+        // wait for the guest to catch up
+        while (next == atomic_load_explicit(&q_head, memory_order_acquire)) usleep(1000);
+        queue[t] = buf[i];
+        atomic_store_explicit(&q_tail, next, memory_order_release);
+      }
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+static void init_fifo() {
+  int ret = mkfifo(FIFO_PATH, 0666);
+  Assert(ret == 0 || errno == EEXIST, "Can not create %s", FIFO_PATH);
+  pthread_t t;
+  ret = pthread_create(&t, NULL, serial_input_thread, NULL);
+  Assert(ret == 0, "failed to create the serial input thread");
+  Log("Serial input is read from %s", FIFO_PATH);
+}
+#else
+static bool serial_has_input() { return false; }
+static uint8_t serial_getc() { return 0xff; }
+#endif
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
@@ -34,7 +124,12 @@ static void serial_io_handler(uint32_t offset, int len, bool is_write) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = replay_input(REPLAY_SERIAL, serial_getc());
+      break;
+    case LSR_OFFSET:
+      assert(!is_write);
+      serial_base[LSR_OFFSET] = replay_input(REPLAY_SERIAL,
+          LSR_THRE | LSR_TEMT | (serial_has_input() ? LSR_DR : 0));
       break;
     default: panic("do not support offset = %d", offset);
   }
@@ -47,5 +142,6 @@ void init_serial() {
 #else
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
-
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
 }
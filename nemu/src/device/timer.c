@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/replay.h>
 #include <device/alarm.h>
 #include <utils.h>
 
@@ -22,13 +23,15 @@ static uint32_t *rtc_port_base = NULL;
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = replay_input(REPLAY_RTC, get_time());
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
 }
 
-#ifndef CONFIG_TARGET_AM
+// with a CLINT, the guest programs its own timer interrupts with mtimecmp
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
+#define USE_TIMER_INTR 1
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
     extern void dev_raise_intr();
@@ -44,5 +47,5 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+  IFDEF(USE_TIMER_INTR, add_alarm_handle(timer_intr));
 }
@@ -0,0 +1,163 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* Headless screen backend. Frames are copied into a bounded queue on sync and
+ * written out by a background thread.
+ *
+ * With VGA_RECORD_PPM, each frame is a complete P6 image.
+ * With VGA_RECORD_DELTA, the file starts with
+ *   char magic[8] = "NEMUVGA1"; uint32_t width, height;
+ * followed by the frames, each being
+ *   uint64_t nr_guest_inst; uint32_t nr_band;
+ * and `nr_band' bands of
+ *   uint32_t y, h; uint32_t pixels[h][width];  // 0x00RRGGBB
+ * in host byte order. A band replaces the scanlines [y, y + h) of the previous
+ * frame, and the first frame covers the whole screen. */
+
+#include <common.h>
+#include <cpu/cpu.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define NR_SLOT CONFIG_VGA_RECORD_QUEUE
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+} Slot;
+
+static Slot slot[NR_SLOT];
+static int slot_w = 0, slot_r = 0; // only used by the CPU thread and the writer, respectively
+static sem_t nr_free, nr_full;
+static uint32_t width, height;
+static FILE *fp = NULL;
+static bool is_pipe = false;
+static pthread_t writer;
+
+#define EXIT_SLOT ((size_t)-1)
+
+static void write_slot(Slot *s) {
+#ifdef CONFIG_VGA_RECORD_PPM
+  // convert ARGB to RGB here instead of on the CPU thread
+  static uint8_t *rgb = NULL;
+  if (rgb == NULL) { rgb = malloc(width * height * 3); assert(rgb); }
+  uint32_t *p = (uint32_t *)s->buf;
+  for (uint32_t i = 0; i < width * height; i ++) {
+    rgb[i * 3 + 0] = p[i] >> 16;
+    rgb[i * 3 + 1] = p[i] >> 8;
+    rgb[i * 3 + 2] = p[i];
+  }
+  fprintf(fp, "P6\n%u %u\n255\n", width, height);
+  fwrite(rgb, 3, width * height, fp);
+#else
+  fwrite(s->buf, 1, s->len, fp);
+#endif
+}
+
+static void* writer_thread(void *arg) {
+  while (true) {
+    sem_wait(&nr_full);
+    Slot *s = &slot[slot_r];
+    slot_r = (slot_r + 1) % NR_SLOT;
+    if (s->len == EXIT_SLOT) break;
+    write_slot(s);
+    sem_post(&nr_free);
+  }
+  fflush(fp);
+  return NULL;
+}
+
+static Slot *cur = NULL;
+
+static void begin_frame() {
+  // wait for the writer thread if the queue is full
+  sem_wait(&nr_free);
+  cur = &slot[slot_w];
+  cur->len = 0;
+#ifdef CONFIG_VGA_RECORD_DELTA
+  extern HART_LOCAL uint64_t g_nr_guest_inst;
+  memcpy(cur->buf, &g_nr_guest_inst, sizeof(uint64_t));
+  memset(cur->buf + sizeof(uint64_t), 0, sizeof(uint32_t));
+  cur->len = sizeof(uint64_t) + sizeof(uint32_t);
+#endif
+}
+
+static void end_frame() {
+  slot_w = (slot_w + 1) % NR_SLOT;
+  cur = NULL;
+  sem_post(&nr_full);
+}
+
+void screen_record_band(uint32_t y, uint32_t h, void *fb) {
+  if (cur == NULL) begin_frame();
+#ifdef CONFIG_VGA_RECORD_DELTA
+  uint32_t *nr_band = (uint32_t *)(cur->buf + sizeof(uint64_t));
+  (*nr_band) ++;
+  uint32_t hdr[2] = { y, h };
+  memcpy(cur->buf + cur->len, hdr, sizeof(hdr));
+  cur->len += sizeof(hdr);
+  size_t size = h * width * sizeof(uint32_t);
+  memcpy(cur->buf + cur->len, (uint32_t *)fb + y * width, size);
+  cur->len += size;
+#endif
+}
+
+void screen_record_frame(void *fb) {
+  if (cur == NULL) begin_frame();
+#ifdef CONFIG_VGA_RECORD_PPM
+  memcpy(cur->buf, fb, width * height * sizeof(uint32_t));
+  cur->len = width * height * sizeof(uint32_t);
+#endif
+  end_frame();
+}
+
+static void exit_screen_record() {
+  // the writer thread finishes the frames before the exit slot
+  sem_wait(&nr_free);
+  slot[slot_w].len = EXIT_SLOT;
+  sem_post(&nr_full);
+  pthread_join(writer, NULL);
+  if (is_pipe) pclose(fp);
+  else fclose(fp);
+}
+
+void init_screen_record(uint32_t w, uint32_t h) {
+  width = w;
+  height = h;
+  const char *path = CONFIG_VGA_RECORD_PATH;
+  is_pipe = (path[0] == '|');
+  fp = (is_pipe ? popen(path + 1, "w") : fopen(path, "wb"));
+  Assert(fp, "Can not open '%s' to record the screen", path);
+#ifdef CONFIG_VGA_RECORD_DELTA
+  fwrite("NEMUVGA1", 1, 8, fp);
+  uint32_t hdr[2] = { w, h };
+  fwrite(hdr, sizeof(hdr), 1, fp);
+#endif
+
+  // the largest frame has every scanline, in up to h / 2 + 1 bands
+  size_t size = sizeof(uint64_t) + sizeof(uint32_t) + w * h * sizeof(uint32_t) +
+    (h / 2 + 1) * 2 * sizeof(uint32_t);
+  for (int i = 0; i < NR_SLOT; i ++) {
+    slot[i].buf = malloc(size);
+    assert(slot[i].buf);
+  }
+  sem_init(&nr_free, 0, NR_SLOT);
+  sem_init(&nr_full, 0, 0);
+  int ret = pthread_create(&writer, NULL, writer_thread, NULL);
+  Assert(ret == 0, "failed to create the writer thread of the screen recorder");
+  atexit(exit_screen_record);
+  Log("Recording the screen to %s", path);
+}
@@ -15,6 +15,8 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/alarm.h>
+#include <memory/paddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,8 +36,159 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+enum {
+  reg_size,   // (width << 16) | height
+  reg_sync,   // written by the guest when a frame is ready
+  reg_accel,  // whether the 2D command engine is present
+  reg_cmd,    // guest physical address of the array of commands
+  reg_nr_cmd, // writing it runs the commands
+  nr_reg
+};
+
+// one bit per scanline written since the last update of the screen
+static uint64_t *dirty_row = NULL;
+
+static inline void mark_row(uint32_t y) {
+  dirty_row[y / 64] |= 1ull << (y % 64);
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  uint32_t pitch = screen_width() * sizeof(uint32_t);
+  mark_row(offset / pitch);
+  mark_row((offset + len - 1) / pitch);
+}
+
+#ifdef CONFIG_VGA_GPU
+/* 2D command engine. The guest builds an array of commands in pmem, and all
+ * of them are run by the host when reg_nr_cmd is written. Rectangles are
+ * clipped to the screen, and rows are filled and moved with memcpy(). */
+enum { GPU_NOP, GPU_FILL, GPU_COPY, GPU_BLIT };
+
+typedef struct {
+  uint32_t op;
+  uint32_t x, y, w, h; // destination rectangle in the screen
+  // FILL: arg[0] = color
+  // COPY: arg[0], arg[1] = top left corner of the source rectangle in the screen
+  // BLIT: arg[0] = guest physical address of the source pixels, arg[1] = pitch in pixels,
+  //       or 0 for the unclipped width
+  uint32_t arg[3];
+} GPUCmd;
+
+static inline uint32_t* fb_at(uint32_t x, uint32_t y) {
+  return (uint32_t *)vmem + y * screen_width() + x;
+}
+
+static void gpu_fill(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color) {
+  uint32_t *row = fb_at(x, y);
+  for (uint32_t i = 0; i < w; i ++) row[i] = color;
+  for (uint32_t j = 1; j < h; j ++) {
+    memcpy(row + j * screen_width(), row, w * sizeof(uint32_t));
+  }
+}
+
+static void gpu_copy(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t sx, uint32_t sy) {
+  if (sx >= screen_width() || sy >= screen_height()) return;
+  if (w > screen_width() - sx) w = screen_width() - sx;
+  if (h > screen_height() - sy) h = screen_height() - sy;
+  // overlapping rectangles are copied in the direction that reads rows before overwriting them
+  for (uint32_t k = 0; k < h; k ++) {
+    uint32_t j = (y <= sy ? k : h - 1 - k);
+    memmove(fb_at(x, y + j), fb_at(sx, sy + j), w * sizeof(uint32_t));
+  }
+}
+
+static void gpu_blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, paddr_t src, uint32_t pitch) {
+  size_t len = ((size_t)(h - 1) * pitch + w) * sizeof(uint32_t);
+  Assert(in_pmem(src) && in_pmem(src + len - 1), "gpu: pixels [" FMT_PADDR ", " FMT_PADDR ") are out of pmem",
+      src, (paddr_t)(src + len));
+  pmem_populate(src, len);
+  for (uint32_t j = 0; j < h; j ++) {
+    memcpy(fb_at(x, y + j), guest_to_host(src + (paddr_t)j * pitch * sizeof(uint32_t)), w * sizeof(uint32_t));
+  }
+}
+
+static void gpu_exec(GPUCmd *c) {
+  uint32_t x = c->x, y = c->y, w = c->w, h = c->h;
+  if (x >= screen_width() || y >= screen_height()) return;
+  if (w > screen_width() - x) w = screen_width() - x;
+  if (h > screen_height() - y) h = screen_height() - y;
+  if (w == 0 || h == 0) return;
+  switch (c->op) {
+    case GPU_NOP: return;
+    case GPU_FILL: gpu_fill(x, y, w, h, c->arg[0]); break;
+    case GPU_COPY: gpu_copy(x, y, w, h, c->arg[0], c->arg[1]); break;
+    // the default pitch is the width before clipping
+    case GPU_BLIT: gpu_blit(x, y, w, h, c->arg[0], (c->arg[1] == 0 ? c->w : c->arg[1])); break;
+    default: panic("gpu: unknown command %u", c->op);
+  }
+  for (uint32_t j = 0; j < h; j ++) mark_row(y + j);
+}
+
+static void gpu_run() {
+  paddr_t addr = vgactl_port_base[reg_cmd];
+  uint32_t n = vgactl_port_base[reg_nr_cmd];
+  size_t len = (size_t)n * sizeof(GPUCmd);
+  if (n == 0) return;
+  Assert(in_pmem(addr) && in_pmem(addr + len - 1), "gpu: commands [" FMT_PADDR ", " FMT_PADDR ") are out of pmem",
+      addr, (paddr_t)(addr + len));
+  pmem_populate(addr, len);
+  GPUCmd *cmd = (GPUCmd *)guest_to_host(addr);
+  for (uint32_t i = 0; i < n; i ++) {
+    gpu_exec(&cmd[i]);
+  }
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_nr_cmd * sizeof(uint32_t)) {
+    gpu_run();
+  }
+}
+#endif
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
-#ifndef CONFIG_TARGET_AM
+/* Call `band(y, h, arg)' for each maximal run of scanlines [y, y + h) set
+ * in `map' and clear them. The cost is proportional to the number of bitmap
+ * words plus the number of runs, not to the size of the screen. */
+static bool foreach_band(uint64_t *map, void (*band)(uint32_t y, uint32_t h, void *arg), void *arg) {
+  uint32_t nr_word = (screen_height() + 63) / 64;
+  bool any = false, in_band = false;
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < nr_word; i ++) {
+    uint64_t w = map[i];
+    if (w == 0 && !in_band) continue;
+    map[i] = 0;
+    if (w == ~0ull && in_band) continue;
+    // visit the boundaries of runs inside this word
+    for (uint32_t b = 0; b < 64; ) {
+      uint64_t rest = (in_band ? ~w : w) >> b;
+      if (rest == 0) break;
+      b += __builtin_ctzll(rest);
+      if (in_band) { band(start, i * 64 + b - start, arg); }
+      else { start = i * 64 + b; any = true; }
+      in_band = !in_band;
+    }
+  }
+  if (in_band) band(start, screen_height() - start, arg);
+  return any;
+}
+
+#if defined(CONFIG_VGA_SCREEN_RECORD)
+void init_screen_record(uint32_t w, uint32_t h);
+void screen_record_band(uint32_t y, uint32_t h, void *fb);
+void screen_record_frame(void *fb);
+
+static void init_screen() {
+  init_screen_record(SCREEN_W, SCREEN_H);
+}
+
+static inline void update_screen() {
+  // a frame without any change is not recorded
+  if (foreach_band(dirty_row, screen_record_band, vmem)) {
+    screen_record_frame(vmem);
+  }
+}
+#elif !defined(CONFIG_TARGET_AM)
 #include <SDL2/SDL.h>
 
 static SDL_Renderer *renderer = NULL;
@@ -52,41 +205,176 @@ static void init_screen() {
       0, &window, &renderer);
   SDL_SetWindowTitle(window, title);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+      SDL_TEXTUREACCESS_STREAMING, SCREEN_W, SCREEN_H);
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+#define ROW_SIZE (SCREEN_W * sizeof(uint32_t))
+
+// copy the scanlines [y, y + h) of the frame `src' to the texture
+static void upload_band(uint32_t y, uint32_t h, void *src) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  void *pixels;
+  int pitch;
+  SDL_LockTexture(texture, &rect, &pixels, &pitch);
+  uint8_t *p = (uint8_t *)src + y * ROW_SIZE;
+  if (pitch == ROW_SIZE) {
+    memcpy(pixels, p, h * ROW_SIZE);
+  } else {
+    for (uint32_t i = 0; i < h; i ++) {
+      memcpy((uint8_t *)pixels + i * pitch, p + i * ROW_SIZE, ROW_SIZE);
+    }
+  }
+  SDL_UnlockTexture(texture);
+}
+
+static void present(uint64_t *damage, void *src) {
+  // nothing to present if the frame did not change
+  if (!foreach_band(damage, upload_band, src)) return;
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_VGA_RENDER_THREAD
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/* Frames are handed to the render thread by triple buffering. The CPU thread
+ * owns `back', the render thread owns `front', and the third buffer is in
+ * `ready'. Buffers only change hands by atomic operations on `ready', so
+ * neither thread ever waits for the other. If the render thread falls behind,
+ * the CPU thread takes back the frame in `ready' and publishes a newer one. */
+#define NR_ROW_WORD ((SCREEN_H + 63) / 64)
+#define FRAME_FRESH 0x4 // `ready' holds a frame not taken by the render thread
+
+typedef struct {
+  uint32_t pixels[SCREEN_W * SCREEN_H];
+  // rows which differ from the frame last taken by the render thread
+  uint64_t damage[NR_ROW_WORD];
+  // rows changed in vmem since the buffer was filled, used by the CPU thread only
+  uint64_t stale[NR_ROW_WORD];
+} Frame;
+
+static Frame frame[3];
+static int back = 0, front = 1;
+static _Atomic int ready = 2;
+static sem_t screen_inited;
+
+static void copy_band(uint32_t y, uint32_t h, void *dst) {
+  memcpy((uint8_t *)dst + y * ROW_SIZE, (uint8_t *)vmem + y * ROW_SIZE, h * ROW_SIZE);
+}
+
+static inline void update_screen() {
+  uint64_t dirty[NR_ROW_WORD], copy[NR_ROW_WORD];
+  Frame *f = &frame[back];
+  for (int i = 0; i < NR_ROW_WORD; i ++) {
+    dirty[i] = dirty_row[i];
+    dirty_row[i] = 0;
+    copy[i] = f->stale[i] | dirty[i];
+    f->stale[i] = 0;
+    frame[(back + 1) % 3].stale[i] |= dirty[i];
+    frame[(back + 2) % 3].stale[i] |= dirty[i];
+  }
+  foreach_band(copy, copy_band, f->pixels);
+
+  int old = atomic_load(&ready);
+  do {
+    memcpy(f->damage, dirty, sizeof(dirty));
+    if (old & FRAME_FRESH) {
+      // the render thread skipped this frame, carry its damage over
+      uint64_t *skipped = frame[old & ~FRAME_FRESH].damage;
+      for (int i = 0; i < NR_ROW_WORD; i ++) f->damage[i] |= skipped[i];
+    }
+  } while (!atomic_compare_exchange_weak(&ready, &old, back | FRAME_FRESH));
+  back = old & ~FRAME_FRESH;
+
+  // wake up the render thread
+  SDL_Event event = { .type = SDL_USEREVENT };
+  SDL_PushEvent(&event);
+}
+
+void sdl_handle_event(SDL_Event *event);
+
+static void* render_thread(void *arg) {
+  init_screen();
+  sem_post(&screen_inited);
+  while (true) {
+    SDL_Event event;
+    if (SDL_WaitEventTimeout(&event, 1000 / TIMER_HZ)) {
+      do { sdl_handle_event(&event); } while (SDL_PollEvent(&event));
+    }
+    int x = atomic_load(&ready);
+    if ((x & FRAME_FRESH) && atomic_compare_exchange_strong(&ready, &x, front)) {
+      front = x & ~FRAME_FRESH;
+      // the damage may still be read by the CPU thread, so leave it as it is
+      uint64_t damage[NR_ROW_WORD];
+      memcpy(damage, frame[front].damage, sizeof(damage));
+      present(damage, frame[front].pixels);
+    }
+  }
+  return NULL;
+}
+
+static void start_render_thread() {
+  pthread_t t;
+  sem_init(&screen_inited, 0, 0);
+  int ret = pthread_create(&t, NULL, render_thread, NULL);
+  Assert(ret == 0, "failed to create the render thread");
+  // SDL is not initialized by other devices before the window is ready
+  sem_wait(&screen_inited);
+}
+#else
+static inline void update_screen() {
+  present(dirty_row, vmem);
+}
+#endif
 #else
 static void init_screen() {}
 
+static void upload_band(uint32_t y, uint32_t h, void *arg) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(),
+      screen_width(), h, false);
+}
+
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  if (foreach_band(dirty_row, upload_band, NULL)) {
+    io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+  }
 }
 #endif
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  // the sync register is written by the guest when a frame is ready
+  if (vgactl_port_base[reg_sync]) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    vgactl_port_base[reg_sync] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  vgactl_port_base = (uint32_t *)new_space(space_size);
+  memset(vgactl_port_base, 0, space_size);
+  vgactl_port_base[reg_size] = (screen_width() << 16) | screen_height();
+  vgactl_port_base[reg_accel] = ISDEF(CONFIG_VGA_GPU);
+  io_callback_t callback = MUXDEF(CONFIG_VGA_GPU, vgactl_io_handler, NULL);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, space_size, callback);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, space_size, callback);
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
+  dirty_row = calloc((screen_height() + 63) / 64, sizeof(dirty_row[0]));
+  assert(dirty_row);
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  MUXDEF(CONFIG_VGA_RENDER_THREAD, start_render_thread(), init_screen());
+#endif
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  // the first sync shows the whole screen
+  for (uint32_t y = 0; y < screen_height(); y ++) mark_row(y);
 }
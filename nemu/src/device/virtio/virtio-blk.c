@@ -0,0 +1,123 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/virtio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 512
+
+enum { VIRTIO_BLK_T_IN = 0, VIRTIO_BLK_T_OUT = 1, VIRTIO_BLK_T_FLUSH = 4, VIRTIO_BLK_T_GET_ID = 8 };
+enum { VIRTIO_BLK_S_OK = 0, VIRTIO_BLK_S_IOERR = 1, VIRTIO_BLK_S_UNSUPP = 2 };
+#define VIRTIO_BLK_F_FLUSH (1ull << 9)
+#define VIRTIO_BLK_ID_BYTES 20
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} VirtioBlkHdr;
+
+static struct {
+  uint64_t capacity; // in sectors
+} config = {};
+
+static uint8_t *img = NULL; // the image is mapped, and written back by the kernel
+
+/* A request is a header, the data buffers and a status byte. The data of
+ * each buffer is a single copy between the image and pmem. */
+static uint32_t blk_request(VirtReq *req) {
+  if (req->nr_seg < 2 || req->seg[0].len < sizeof(VirtioBlkHdr) ||
+      !req->seg[req->nr_seg - 1].write || req->seg[req->nr_seg - 1].len < 1) {
+    panic("virtio-blk: bad request");
+  }
+  VirtioBlkHdr *hdr = (VirtioBlkHdr *)req->seg[0].buf;
+  uint8_t *status = req->seg[req->nr_seg - 1].buf;
+  uint64_t pos = hdr->sector * SECTOR_SIZE;
+  uint64_t end = config.capacity * SECTOR_SIZE;
+  uint32_t written = 0;
+  *status = VIRTIO_BLK_S_OK;
+  for (int i = 1; i < req->nr_seg - 1; i ++) {
+    uint8_t *buf = req->seg[i].buf;
+    uint32_t len = req->seg[i].len;
+    switch (hdr->type) {
+      case VIRTIO_BLK_T_IN:
+      case VIRTIO_BLK_T_OUT:
+        if (pos > end || len > end - pos) { *status = VIRTIO_BLK_S_IOERR; return written + 1; }
+        if (hdr->type == VIRTIO_BLK_T_IN) { memcpy(buf, img + pos, len); written += len; }
+        else memcpy(img + pos, buf, len);
+        pos += len;
+        break;
+      case VIRTIO_BLK_T_GET_ID: {
+        static const char id[VIRTIO_BLK_ID_BYTES] = "nemu-virtio-blk";
+        uint32_t n = (len < VIRTIO_BLK_ID_BYTES ? len : VIRTIO_BLK_ID_BYTES);
+        memcpy(buf, id, n);
+        written += n;
+        break;
+      }
+      case VIRTIO_BLK_T_FLUSH: break;
+      default: *status = VIRTIO_BLK_S_UNSUPP; break;
+    }
+  }
+  if (hdr->type == VIRTIO_BLK_T_FLUSH) msync(img, end, MS_ASYNC);
+  return written + 1;
+}
+
+static void blk_notify(VirtioDev *dev, int q) {
+  VirtReq req;
+  while (virtq_pop(dev, q, &req)) {
+    virtq_push(dev, q, &req, blk_request(&req));
+  }
+  virtq_flush(dev, q);
+}
+
+static VirtioDev blk = {
+  .name = "virtio-blk", .features = VIRTIO_BLK_F_FLUSH, .irq = CONFIG_VIRTIO_BLK_IRQ,
+  .config = &config, .config_size = sizeof(config), .notify = blk_notify,
+};
+
+static void blk_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_io_handler(&blk, offset, len, is_write);
+}
+
+static void init_blk_img() {
+  const char *path = CONFIG_VIRTIO_BLK_IMG_PATH;
+  if (path[0] == '\0') return;
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    Log("Can not open virtio-blk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  config.capacity = st.st_size / SECTOR_SIZE;
+  if (config.capacity > 0) {
+    img = mmap(NULL, config.capacity * SECTOR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map virtio-blk image %s", path);
+  }
+  close(fd);
+  Log("virtio-blk image %s with %" PRIu64 " sectors", path, config.capacity);
+}
+
+void init_virtio_blk() {
+  init_blk_img();
+  // a device ID of 0 tells the driver that there is no device
+  blk.device_id = (img != NULL ? VIRTIO_ID_BLOCK : 0);
+  virtio_mmio_init(&blk, CONFIG_VIRTIO_BLK_MMIO, blk_io_handler);
+}
@@ -0,0 +1,113 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/alarm.h>
+#include <device/virtio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { RECEIVEQ = 0, TRANSMITQ = 1 };
+
+static struct {
+  uint16_t cols, rows;
+  uint32_t max_nr_ports;
+  uint32_t emerg_wr;
+} config = {};
+
+/* Input is polled at TIMER_HZ. What is read from the host but not taken by
+ * the guest yet is kept here until the driver posts more receive buffers. */
+static int input_fd = -1;
+static uint8_t inbuf[4096];
+static uint32_t inlen = 0;
+
+static void console_rx(VirtioDev *dev) {
+  if (inlen < sizeof(inbuf) && input_fd != -1) {
+    ssize_t n = read(input_fd, inbuf + inlen, sizeof(inbuf) - inlen);
+    if (n > 0) inlen += n;
+  }
+  uint32_t pos = 0;
+  VirtReq req;
+  while (pos < inlen && virtq_pop(dev, RECEIVEQ, &req)) {
+    uint32_t written = 0;
+    for (int i = 0; i < req.nr_seg && pos < inlen; i ++) {
+      if (!req.seg[i].write) continue;
+      uint32_t n = (req.seg[i].len < inlen - pos ? req.seg[i].len : inlen - pos);
+      memcpy(req.seg[i].buf, inbuf + pos, n);
+      pos += n;
+      written += n;
+    }
+    virtq_push(dev, RECEIVEQ, &req, written);
+  }
+  if (pos > 0) {
+    memmove(inbuf, inbuf + pos, inlen - pos);
+    inlen -= pos;
+    virtq_flush(dev, RECEIVEQ);
+  }
+}
+
+static void console_tx(VirtioDev *dev) {
+  VirtReq req;
+  while (virtq_pop(dev, TRANSMITQ, &req)) {
+    for (int i = 0; i < req.nr_seg; i ++) {
+      if (req.seg[i].write) continue;
+      __attribute__((unused)) ssize_t ret = write(STDERR_FILENO, req.seg[i].buf, req.seg[i].len);
+    }
+    virtq_push(dev, TRANSMITQ, &req, 0);
+  }
+  virtq_flush(dev, TRANSMITQ);
+}
+
+static void console_notify(VirtioDev *dev, int q) {
+  if (q == TRANSMITQ) console_tx(dev);
+  else console_rx(dev);
+}
+
+static VirtioDev console = {
+  .name = "virtio-console", .device_id = VIRTIO_ID_CONSOLE, .irq = CONFIG_VIRTIO_CONSOLE_IRQ,
+  .config = &config, .config_size = sizeof(config), .notify = console_notify,
+};
+
+static void console_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_io_handler(&console, offset, len, is_write);
+}
+
+static void console_poll() {
+  console_rx(&console);
+}
+
+static void init_console_input() {
+  const char *path = CONFIG_VIRTIO_CONSOLE_INPUT;
+  if (path[0] == '\0') return;
+  if (mkfifo(path, 0666) != 0 && errno != EEXIST) {
+    Log("Can not create %s for the input of virtio-console", path);
+    return;
+  }
+  // reads return at once, whether there is a writer or not
+  input_fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (input_fd == -1) {
+    Log("Can not open %s for the input of virtio-console", path);
+    return;
+  }
+  Log("Input of virtio-console: %s", path);
+}
+
+void init_virtio_console() {
+  init_console_input();
+  virtio_mmio_init(&console, CONFIG_VIRTIO_CONSOLE_MMIO, console_io_handler);
+  add_alarm_handle(console_poll);
+}
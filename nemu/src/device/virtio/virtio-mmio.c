@@ -0,0 +1,223 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/intr.h>
+#include <device/virtio.h>
+#include <memory/paddr.h>
+
+enum {
+  MMIO_MAGIC_VALUE         = 0x000,
+  MMIO_VERSION             = 0x004,
+  MMIO_DEVICE_ID           = 0x008,
+  MMIO_VENDOR_ID           = 0x00c,
+  MMIO_DEVICE_FEATURES     = 0x010,
+  MMIO_DEVICE_FEATURES_SEL = 0x014,
+  MMIO_DRIVER_FEATURES     = 0x020,
+  MMIO_DRIVER_FEATURES_SEL = 0x024,
+  MMIO_QUEUE_SEL           = 0x030,
+  MMIO_QUEUE_NUM_MAX       = 0x034,
+  MMIO_QUEUE_NUM           = 0x038,
+  MMIO_QUEUE_READY         = 0x044,
+  MMIO_QUEUE_NOTIFY        = 0x050,
+  MMIO_INTERRUPT_STATUS    = 0x060,
+  MMIO_INTERRUPT_ACK       = 0x064,
+  MMIO_STATUS              = 0x070,
+  MMIO_QUEUE_DESC_LOW      = 0x080,
+  MMIO_QUEUE_DESC_HIGH     = 0x084,
+  MMIO_QUEUE_DRIVER_LOW    = 0x090,
+  MMIO_QUEUE_DRIVER_HIGH   = 0x094,
+  MMIO_QUEUE_DEVICE_LOW    = 0x0a0,
+  MMIO_QUEUE_DEVICE_HIGH   = 0x0a4,
+  MMIO_CONFIG_GENERATION   = 0x0fc,
+  MMIO_CONFIG              = 0x100,
+};
+
+#define MAGIC_VALUE 0x74726976 // "virt"
+#define VENDOR_ID   0x554d454e // "NEMU"
+#define VIRTIO_F_VERSION_1 (1ull << 32)
+#define VIRTIO_INT_USED_RING 0x1
+
+#define VIRTQ_DESC_F_NEXT     1
+#define VIRTQ_DESC_F_WRITE    2
+#define VIRTQ_DESC_F_INDIRECT 4
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} VirtqDesc;
+
+typedef struct {
+  uint32_t id;
+  uint32_t len;
+} VirtqUsedElem;
+
+#define R(dev, off) ((dev)->regs[(off) / sizeof(uint32_t)])
+
+// addresses from the guest are 64-bit, and must not alias into pmem when truncated
+static void* guest(VirtioDev *dev, uint64_t addr64, size_t len) {
+  if (len == 0) return NULL;
+  paddr_t addr = addr64;
+  Assert(addr == addr64, "%s: address 0x%" PRIx64 " is out of the physical address space", dev->name, addr64);
+  Assert(in_pmem(addr) && in_pmem(addr + len - 1), "%s: [" FMT_PADDR ", " FMT_PADDR ") is out of pmem",
+      dev->name, addr, (paddr_t)(addr + len));
+  pmem_populate(addr, len);
+  return guest_to_host(addr);
+}
+
+static void update_irq(VirtioDev *dev) {
+  plic_set_irq(dev->irq, dev->intr_status != 0);
+}
+
+/* ring operations */
+bool virtq_pop(VirtioDev *dev, int q, VirtReq *req) {
+  VirtQueue *vq = &dev->queue[q];
+  if (!vq->ready || vq->num == 0) return false;
+  // flags, idx, ring[num]
+  uint16_t *avail = guest(dev, vq->avail, sizeof(uint16_t) * (2 + vq->num));
+  if (vq->last_avail == avail[1]) return false;
+  uint16_t idx = avail[2 + vq->last_avail % vq->num];
+  vq->last_avail ++;
+
+  VirtqDesc *desc = guest(dev, vq->desc, sizeof(VirtqDesc) * vq->num);
+  req->head = idx;
+  req->nr_seg = 0;
+  while (true) {
+    Assert(idx < vq->num && req->nr_seg < VIRTIO_NR_SEG, "%s: bad descriptor chain from %d", dev->name, req->head);
+    VirtqDesc *d = &desc[idx];
+    Assert(!(d->flags & VIRTQ_DESC_F_INDIRECT), "%s: indirect descriptors are not offered", dev->name);
+    req->seg[req->nr_seg ++] = (typeof(req->seg[0])) { .buf = guest(dev, d->addr, d->len),
+      .len = d->len, .write = (d->flags & VIRTQ_DESC_F_WRITE) != 0, .addr = d->addr };
+    if (!(d->flags & VIRTQ_DESC_F_NEXT)) break;
+    idx = d->next;
+  }
+  return true;
+}
+
+void virtq_push(VirtioDev *dev, int q, VirtReq *req, uint32_t written) {
+  VirtQueue *vq = &dev->queue[q];
+  // flags, idx, ring[num]
+  VirtqUsedElem *ring = guest(dev, vq->used + 2 * sizeof(uint16_t), sizeof(VirtqUsedElem) * vq->num);
+  ring[vq->used_idx % vq->num] = (VirtqUsedElem) { .id = req->head, .len = written };
+  vq->used_idx ++;
+  for (int i = 0; i < req->nr_seg; i ++) {
+    if (req->seg[i].write) dev_pmem_written(req->seg[i].addr, req->seg[i].len);
+  }
+}
+
+void virtq_flush(VirtioDev *dev, int q) {
+  VirtQueue *vq = &dev->queue[q];
+  uint16_t *used = guest(dev, vq->used, sizeof(uint16_t) * 2);
+  if (used[1] == vq->used_idx) return;
+  used[1] = vq->used_idx;
+  dev_pmem_written(vq->used, sizeof(uint16_t) * 2 + sizeof(VirtqUsedElem) * vq->num);
+
+  uint16_t *avail = guest(dev, vq->avail, sizeof(uint16_t) * 2);
+  if (!(avail[0] & VIRTQ_AVAIL_F_NO_INTERRUPT)) {
+    dev->intr_status |= VIRTIO_INT_USED_RING;
+    R(dev, MMIO_INTERRUPT_STATUS) = dev->intr_status;
+    update_irq(dev);
+  }
+}
+
+/* transport */
+static void virtio_reset(VirtioDev *dev) {
+  dev->driver_features = 0;
+  dev->status = 0;
+  dev->intr_status = 0;
+  memset(dev->queue, 0, sizeof(dev->queue));
+  update_irq(dev);
+}
+
+// the registers read by the driver are refreshed after every write
+static void sync_regs(VirtioDev *dev) {
+  uint32_t sel = R(dev, MMIO_QUEUE_SEL);
+  VirtQueue *vq = (sel < VIRTIO_NR_QUEUE ? &dev->queue[sel] : NULL);
+  uint64_t features = (dev->device_id ? dev->features | VIRTIO_F_VERSION_1 : 0);
+  R(dev, MMIO_MAGIC_VALUE) = MAGIC_VALUE;
+  R(dev, MMIO_VERSION) = 2;
+  R(dev, MMIO_DEVICE_ID) = dev->device_id;
+  R(dev, MMIO_VENDOR_ID) = VENDOR_ID;
+  R(dev, MMIO_DEVICE_FEATURES) = (R(dev, MMIO_DEVICE_FEATURES_SEL) < 2 ?
+      features >> (32 * R(dev, MMIO_DEVICE_FEATURES_SEL)) : 0);
+  R(dev, MMIO_QUEUE_NUM_MAX) = (vq ? VIRTIO_QUEUE_NUM_MAX : 0);
+  R(dev, MMIO_QUEUE_READY) = (vq ? vq->ready : 0);
+  R(dev, MMIO_QUEUE_DESC_LOW)    = (vq ? (uint32_t)vq->desc : 0);
+  R(dev, MMIO_QUEUE_DESC_HIGH)   = (vq ? vq->desc >> 32 : 0);
+  R(dev, MMIO_QUEUE_DRIVER_LOW)  = (vq ? (uint32_t)vq->avail : 0);
+  R(dev, MMIO_QUEUE_DRIVER_HIGH) = (vq ? vq->avail >> 32 : 0);
+  R(dev, MMIO_QUEUE_DEVICE_LOW)  = (vq ? (uint32_t)vq->used : 0);
+  R(dev, MMIO_QUEUE_DEVICE_HIGH) = (vq ? vq->used >> 32 : 0);
+  R(dev, MMIO_INTERRUPT_STATUS) = dev->intr_status;
+  R(dev, MMIO_STATUS) = dev->status;
+  R(dev, MMIO_CONFIG_GENERATION) = 0;
+  if (dev->config_size > 0) {
+    memcpy((uint8_t *)dev->regs + MMIO_CONFIG, dev->config, dev->config_size);
+  }
+}
+
+static inline void set_low(uint64_t *x, uint32_t v) { *x = (*x & ~0xffffffffull) | v; }
+static inline void set_high(uint64_t *x, uint32_t v) { *x = (*x & 0xffffffffull) | ((uint64_t)v << 32); }
+
+void virtio_mmio_io_handler(VirtioDev *dev, uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  uint32_t v = R(dev, offset & ~0x3u);
+  uint32_t sel = R(dev, MMIO_QUEUE_SEL);
+  VirtQueue *vq = (sel < VIRTIO_NR_QUEUE ? &dev->queue[sel] : NULL);
+  switch (offset) {
+    case MMIO_DRIVER_FEATURES:
+      if (R(dev, MMIO_DRIVER_FEATURES_SEL) == 0) set_low(&dev->driver_features, v);
+      else if (R(dev, MMIO_DRIVER_FEATURES_SEL) == 1) set_high(&dev->driver_features, v);
+      break;
+    case MMIO_QUEUE_NUM:
+      if (vq) {
+        Assert(v > 0 && v <= VIRTIO_QUEUE_NUM_MAX, "%s: bad queue size %u", dev->name, v);
+        vq->num = v;
+      }
+      break;
+    case MMIO_QUEUE_READY: if (vq) vq->ready = v & 1; break;
+    case MMIO_QUEUE_NOTIFY:
+      if (v < VIRTIO_NR_QUEUE && dev->queue[v].ready) dev->notify(dev, v);
+      break;
+    case MMIO_INTERRUPT_ACK:
+      dev->intr_status &= ~v;
+      update_irq(dev);
+      break;
+    case MMIO_STATUS:
+      if (v == 0) virtio_reset(dev);
+      else dev->status = v;
+      break;
+    case MMIO_QUEUE_DESC_LOW:    if (vq) set_low(&vq->desc, v); break;
+    case MMIO_QUEUE_DESC_HIGH:   if (vq) set_high(&vq->desc, v); break;
+    case MMIO_QUEUE_DRIVER_LOW:  if (vq) set_low(&vq->avail, v); break;
+    case MMIO_QUEUE_DRIVER_HIGH: if (vq) set_high(&vq->avail, v); break;
+    case MMIO_QUEUE_DEVICE_LOW:  if (vq) set_low(&vq->used, v); break;
+    case MMIO_QUEUE_DEVICE_HIGH: if (vq) set_high(&vq->used, v); break;
+    default: break; // the selectors are read back from the registers
+  }
+  sync_regs(dev);
+}
+
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr, void (*callback)(uint32_t, int, bool)) {
+  uint32_t space_size = MMIO_CONFIG + dev->config_size;
+  dev->regs = (uint32_t *)new_space(space_size);
+  memset(dev->regs, 0, space_size);
+  virtio_reset(dev);
+  sync_regs(dev);
+  add_mmio_map(dev->name, addr, dev->regs, space_size, callback);
+}
@@ -17,9 +17,25 @@ SRCS-y += src/nemu-main.c
 DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
+ifndef CONFIG_SMP
+SRCS-BLACKLIST-y += src/cpu/smp.c
+endif
+ifndef CONFIG_SNAPSHOT
+SRCS-BLACKLIST-y += src/cpu/snapshot.c
+endif
+ifndef CONFIG_DIFFTEST_ASYNC
+SRCS-BLACKLIST-y += src/cpu/difftest/async.c
+endif
 
-SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
+SRCS-$(CONFIG_TARGET_LIB) += src/libnemu.c
+ifdef CONFIG_TARGET_LIB
+# instances are only driven through include/libnemu.h, with no monitor or REF API
+DIRS-BLACKLIST-y += src/monitor
+SRCS-BLACKLIST-y += src/nemu-main.c src/engine/$(ENGINE)/init.c src/cpu/difftest/ref.c
+endif
+SHARE = $(if $(CONFIG_TARGET_SHARE)$(CONFIG_TARGET_LIB),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_SMP),-lpthread,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
@@ -15,11 +15,35 @@
 
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  // check every register, so that all the differences are reported
+  bool same = true;
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    same &= difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], gpr(i));
+  }
+  same &= difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+  return same;
 }
 
+// The REF API only copies the GPRs and pc, so each CSR is written by letting
+// REF execute `csrrw zero, csr, t0' at the reset vector.
 void isa_difftest_attach() {
+  const struct { uint32_t no; word_t val; } csrs[] = {
+    { 0x300, cpu.csr.mstatus }, { 0x304, cpu.csr.mie }, { 0x305, cpu.csr.mtvec },
+    { 0x341, cpu.csr.mepc }, { 0x342, cpu.csr.mcause },
+  };
+  CPU_state r = cpu;
+  for (int i = 0; i < ARRLEN(csrs); i ++) {
+    uint32_t inst = (csrs[i].no << 20) | (5 << 15) | (0b001 << 12) | 0x73;
+    r.gpr[5] = csrs[i].val;
+    r.pc = RESET_VECTOR;
+    ref_difftest_memcpy(RESET_VECTOR, &inst, sizeof(inst), DIFFTEST_TO_REF);
+    ref_difftest_regcpy(&r, DIFFTEST_TO_REF);
+    ref_difftest_exec(1);
+  }
+  // the page may not be copied again by the caller
+  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), sizeof(uint32_t), DIFFTEST_TO_REF);
 }
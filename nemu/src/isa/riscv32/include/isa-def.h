@@ -21,6 +21,16 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  // not covered by difftest, which only copies the GPRs and pc
+  struct {
+    word_t mstatus, mie, mtvec, mepc, mcause, mip, mhartid;
+  } csr;
+  // reservation set by LR, the value loaded is compared again by SC
+  struct {
+    bool valid;
+    paddr_t addr;
+    word_t val;
+  } resv;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
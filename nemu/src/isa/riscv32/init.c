@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include "local-include/intr.h"
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -33,6 +34,10 @@ static void restart()
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in M-mode, as the reference design does. */
+  cpu.csr.mstatus = 0x1800;
+  update_intr_enable();
 }
 
 void init_isa()
@@ -43,3 +48,10 @@ void init_isa()
   /* Initialize this virtual computer system. */
   restart();
 }
+
+void isa_init_hart(int id)
+{
+  cpu.csr.mhartid = id;
+  cpu.resv.valid = false;
+  update_intr_enable();
+}
@@ -17,13 +17,15 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include "local-include/intr.h"
+#include <memory/paddr.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_I, TYPE_U, TYPE_S, TYPE_R,
   TYPE_N, // none
 };
 
@@ -42,9 +44,67 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_R: src1R(); src2R();         break;
   }
 }
 
+static word_t* csr(word_t no) {
+  switch (no) {
+    case 0x300: return &cpu.csr.mstatus;
+    case 0x304: return &cpu.csr.mie;
+    case 0x305: return &cpu.csr.mtvec;
+    case 0x341: return &cpu.csr.mepc;
+    case 0x342: return &cpu.csr.mcause;
+    case 0x344: update_mip(); return &cpu.csr.mip;
+    case 0xf14: return &cpu.csr.mhartid;
+    default: longjmp_exception(EX_II);
+  }
+}
+#define CSR(i) (*csr(BITS(i, 11, 0)))
+
+// the CSRs with csr[11:10] = 3 are read-only, e.g. mhartid
+static word_t* csr_w(word_t no) {
+  if (BITS(no, 11, 10) == 3) longjmp_exception(EX_II);
+  return csr(no);
+}
+#define CSRW(i) (*csr_w(BITS(i, 11, 0)))
+
+static void mret() {
+  word_t mpie = cpu.csr.mstatus & MSTATUS_MPIE;
+  // MIE <- MPIE, MPIE <- 1, MPP <- M since there is no U-mode
+  cpu.csr.mstatus = (cpu.csr.mstatus & ~MSTATUS_MIE) | (mpie ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+  update_intr_enable();
+}
+
+/* A extension. An AMO is a single atomic access of the host. SC succeeds if
+ * the word still holds the value loaded by LR, which is compared and swapped
+ * atomically, so a store of the same value by another hart is not noticed. */
+static word_t amo_addr(word_t addr, word_t NO) {
+  if (addr & (sizeof(word_t) - 1)) longjmp_exception(NO);
+  return addr;
+}
+
+static word_t lr(word_t addr) {
+  word_t val = Mr(amo_addr(addr, EX_LAM), sizeof(word_t));
+  cpu.resv.valid = true;
+  cpu.resv.addr = addr;
+  cpu.resv.val = val;
+  return val;
+}
+
+static word_t sc(word_t addr, word_t data) {
+  amo_addr(addr, EX_SAM);
+  bool ok = cpu.resv.valid && cpu.resv.addr == addr && vaddr_cas(addr, cpu.resv.val, data);
+  cpu.resv.valid = false;
+  return !ok;
+}
+
+#define AMO(op) vaddr_amo(amo_addr(src1, EX_SAM), concat(AMO_, op), src2)
+
+static void fence() {
+  IFDEF(CONFIG_SMP, __atomic_thread_fence(__ATOMIC_SEQ_CST));
+}
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -61,7 +121,27 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
+  INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w     , R, R(rd) = lr(src1));
+  INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w     , R, R(rd) = sc(src1, src2));
+  INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, R(rd) = AMO(SWAP));
+  INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , R, R(rd) = AMO(ADD));
+  INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , R, R(rd) = AMO(XOR));
+  INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w , R, R(rd) = AMO(AND));
+  INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , R, R(rd) = AMO(OR));
+  INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w , R, R(rd) = AMO(MIN));
+  INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w , R, R(rd) = AMO(MAX));
+  INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, R(rd) = AMO(MINU));
+  INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, R(rd) = AMO(MAXU));
+  INSTPAT("??????? ????? ????? 000 ????? 00011 11", fence    , N, fence());
+  INSTPAT("??????? ????? ????? 001 ????? 00011 11", fence.i  , N);
+
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, word_t t = CSR(imm); CSRW(imm) = src1; R(rd) = t; update_intr_enable());
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, word_t t = CSR(imm); if (BITS(s->isa.inst.val, 19, 15) != 0) CSRW(imm) = t | src1; R(rd) = t; update_intr_enable());
+
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(EX_ECM, s->pc));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = cpu.csr.mepc; mret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N); // a hint, nothing to wait for
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __RISCV_INTR_H__
+#define __RISCV_INTR_H__
+
+// exception codes in mcause
+enum {
+  EX_IAM = 0,  // instruction address misaligned
+  EX_IAF = 1,  // instruction access fault
+  EX_II  = 2,  // illegal instruction
+  EX_BP  = 3,  // breakpoint
+  EX_LAM = 4,  // load address misaligned
+  EX_LAF = 5,  // load access fault
+  EX_SAM = 6,  // store/AMO address misaligned
+  EX_SAF = 7,  // store/AMO access fault
+  EX_ECU = 8,  // environment call from U-mode
+  EX_ECM = 11, // environment call from M-mode
+};
+
+// interrupt codes in mcause, with the interrupt bit
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+enum {
+  IRQ_MSI = 3,  // machine software interrupt
+  IRQ_MTI = 7,  // machine timer interrupt
+  IRQ_MEI = 11, // machine external interrupt
+};
+
+// pending bits in mip, enable bits in mie
+#define MIP_MSIP (1 << IRQ_MSI)
+#define MIP_MTIP (1 << IRQ_MTI)
+#define MIP_MEIP (1 << IRQ_MEI)
+
+// fields of mstatus
+#define MSTATUS_MIE  (1 << 3)
+#define MSTATUS_MPIE (1 << 7)
+#define MSTATUS_MPP  (3 << 11)
+
+// copy the levels of the interrupt lines to mip
+void update_mip();
+// let the CPU loop test only the lines enabled by mstatus and mie
+void update_intr_enable();
+
+#endif
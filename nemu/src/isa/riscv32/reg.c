@@ -23,7 +23,6 @@ const char *regs[] = {"$0", "ra", "sp",  "gp",  "tp", "t0", "t1", "t2",
 
 void isa_reg_display() {
   // display all registers with their names and values
-  extern CPU_state cpu;
   for (int i = 0; i < 32; i++) {
     printf("%-3s: 0x%08x\t", regs[i], gpr(i));
     i++;
@@ -14,15 +14,73 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
+#include "../local-include/intr.h"
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+  cpu.csr.mepc = epc;
+  cpu.csr.mcause = NO;
+  word_t mie = cpu.csr.mstatus & MSTATUS_MIE;
+  // MPIE <- MIE, MIE <- 0, MPP <- M
+  cpu.csr.mstatus = (cpu.csr.mstatus & ~(MSTATUS_MPIE | MSTATUS_MIE)) |
+    (mie ? MSTATUS_MPIE : 0) | MSTATUS_MPP;
+  update_intr_enable();
+  return cpu.csr.mtvec;
+}
+
+word_t isa_access_fault_no(int type) {
+  switch (type) {
+    case MEM_TYPE_IFETCH: return EX_IAF;
+    case MEM_TYPE_READ:   return EX_LAF;
+    default:              return EX_SAF;
+  }
+}
 
-  return 0;
+#ifdef CONFIG_DEVICE
+static uint32_t update_mip_lines() {
+  uint32_t lines = dev_query_intr();
+  cpu.csr.mip = (cpu.csr.mip & ~(MIP_MSIP | MIP_MTIP | MIP_MEIP)) |
+    ((lines & INTR_LINE_MSIP) ? MIP_MSIP : 0) |
+    ((lines & INTR_LINE_MTIP) ? MIP_MTIP : 0) |
+    ((lines & INTR_LINE_MEIP) ? MIP_MEIP : 0);
+  return lines;
+}
+
+void update_mip() {
+  update_mip_lines();
+}
+
+void update_intr_enable() {
+  // requests deferred to the CPU thread are always handled
+  uint32_t en = INTR_LINE_CLINT;
+  if (cpu.csr.mstatus & MSTATUS_MIE) {
+    en |= INTR_LINE_TIMER;
+    if (cpu.csr.mie & MIP_MSIP) en |= INTR_LINE_MSIP;
+    if (cpu.csr.mie & MIP_MTIP) en |= INTR_LINE_MTIP;
+    if (cpu.csr.mie & MIP_MEIP) en |= INTR_LINE_MEIP;
+  }
+  dev_intr_enabled[hart_id] = en;
+}
+
+word_t isa_query_intr() {
+  uint32_t lines = update_mip_lines();
+  if (!(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  if (lines & INTR_LINE_TIMER) {
+    // the timer of NEMU is not gated by mie, as in the original PA
+    dev_set_intr(hart_id, INTR_LINE_TIMER, false);
+    return INTR_BIT | IRQ_MTI;
+  }
+  word_t pending = cpu.csr.mip & cpu.csr.mie;
+  if (pending & MIP_MEIP) return INTR_BIT | IRQ_MEI;
+  if (pending & MIP_MSIP) return INTR_BIT | IRQ_MSI;
+  if (pending & MIP_MTIP) return INTR_BIT | IRQ_MTI;
+  return INTR_EMPTY;
 }
+#else
+void update_mip() {}
+void update_intr_enable() {}
 
 word_t isa_query_intr() {
   return INTR_EMPTY;
 }
+#endif
@@ -0,0 +1,124 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <difftest-def.h>
+#include <libnemu.h>
+#include <sys/mman.h>
+
+/* The machine state of NEMU is in thread-local globals (see MACHINE_LOCAL),
+ * and an instance keeps its own copy of it. The copy is loaded into the
+ * globals of the calling thread before each call and saved after it. Only
+ * pmem is not copied, but bound to the thread by its pointer. */
+struct nemu {
+  CPU_state cpu;
+  NEMUState state;
+  uint64_t nr_inst;
+  uint8_t *pmem;
+};
+
+void execute(uint64_t n);
+uint8_t* init_pmem_mmap();
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static void bind(nemu_t *nemu) {
+  cpu = nemu->cpu;
+  nemu_state = nemu->state;
+  g_nr_guest_inst = nemu->nr_inst;
+  pmem_bind(nemu->pmem);
+}
+
+static void unbind(nemu_t *nemu) {
+  nemu->cpu = cpu;
+  nemu->state = nemu_state;
+  nemu->nr_inst = g_nr_guest_inst;
+  pmem_bind(NULL);
+}
+
+__EXPORT nemu_t* nemu_create() {
+  nemu_t *nemu = calloc(1, sizeof(*nemu));
+  assert(nemu);
+  // pages of pmem are only allocated when they are touched
+  nemu->pmem = init_pmem_mmap();
+  nemu->state.state = NEMU_STOP;
+  bind(nemu);
+  init_isa();
+  unbind(nemu);
+  return nemu;
+}
+
+__EXPORT void nemu_destroy(nemu_t *nemu) {
+  munmap(nemu->pmem, CONFIG_MSIZE);
+  free(nemu);
+}
+
+__EXPORT long nemu_load(nemu_t *nemu, const char *img_file) {
+  FILE *fp = fopen(img_file, "rb");
+  if (fp == NULL) return -1;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  bool ok = (size > 0 && size <= CONFIG_MSIZE - CONFIG_PC_RESET_OFFSET &&
+      fread(nemu->pmem + CONFIG_PC_RESET_OFFSET, size, 1, fp) == 1);
+  fclose(fp);
+  return ok ? size : -1;
+}
+
+__EXPORT int nemu_run(nemu_t *nemu, uint64_t n) {
+  bind(nemu);
+  if (nemu_state.state == NEMU_STOP) {
+    nemu_state.state = NEMU_RUNNING;
+    execute(n);
+    if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+  }
+  int state = nemu_state.state;
+  unbind(nemu);
+  switch (state) {
+    case NEMU_END: return NEMU_RUN_END;
+    case NEMU_ABORT: return NEMU_RUN_ABORT;
+    default: return NEMU_RUN_STOP;
+  }
+}
+
+__EXPORT int nemu_step(nemu_t *nemu) {
+  return nemu_run(nemu, 1);
+}
+
+__EXPORT int nemu_halt_ret(nemu_t *nemu) {
+  return nemu->state.halt_ret;
+}
+
+__EXPORT uint64_t nemu_nr_inst(nemu_t *nemu) {
+  return nemu->nr_inst;
+}
+
+__EXPORT void nemu_regcpy(nemu_t *nemu, void *regs, bool to_nemu) {
+  if (to_nemu) memcpy(&nemu->cpu, regs, DIFFTEST_REG_SIZE);
+  else memcpy(regs, &nemu->cpu, DIFFTEST_REG_SIZE);
+}
+
+__EXPORT bool nemu_memcpy(nemu_t *nemu, uint64_t paddr, void *buf, size_t n, bool to_nemu) {
+  if (n == 0) return true;
+  // written so that a huge `n' can not wrap around
+  if (paddr < CONFIG_MBASE || paddr - CONFIG_MBASE > CONFIG_MSIZE ||
+      n > CONFIG_MSIZE - (paddr - CONFIG_MBASE)) return false;
+  uint8_t *p = nemu->pmem + (paddr - CONFIG_MBASE);
+  if (to_nemu) memcpy(p, buf, n);
+  else memcpy(buf, p, n);
+  return true;
+}
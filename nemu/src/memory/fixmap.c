@@ -0,0 +1,193 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_PMEM_FIXMAP
+#include <ucontext.h>
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error CONFIG_PMEM_FIXMAP is only supported on x86-64 Linux hosts
+#endif
+#ifdef PMEM64
+#error CONFIG_PMEM_FIXMAP requires a 32-bit guest physical address space
+#endif
+
+// the window is reserved by init_pmem_mmap(), see src/memory/mmap.c
+static uint8_t *fixmap_base = NULL;
+static size_t fixmap_size = 0;
+
+word_t paddr_fault_read(paddr_t addr, int len);
+void paddr_fault_write(paddr_t addr, int len, word_t data);
+
+// x86-64 register number (with REX extension) -> index into gregs[]
+static const int greg_idx[16] = {
+  REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+  REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+enum { ACC_LOAD, ACC_STORE_REG, ACC_STORE_IMM };
+
+typedef struct {
+  int type;
+  int len;       // access size in bytes
+  int reg;       // register operand
+  int reg_len;   // size of the register operand
+  bool sext;     // the load is sign-extended into the register
+  bool rex;      // a REX prefix is present (affects 8-bit registers)
+  uint64_t imm;
+  uint64_t ea;   // effective address
+  int ilen;      // length of the host instruction
+} HostAccess;
+
+static uint64_t get_greg(greg_t *gregs, int r) { return gregs[greg_idx[r]]; }
+
+// Decode the `mov'-like instructions the compiler emits for host_read() and
+// host_write(). Return false if the instruction is not understood.
+static bool decode_host_access(uint8_t *p, greg_t *gregs, HostAccess *a) {
+  uint8_t *start = p;
+  bool opsize16 = false;
+  int rex = 0;
+  for (;; p ++) {
+    if (*p == 0x66) opsize16 = true;
+    else if (*p == 0x2e || *p == 0x3e || *p == 0x26 || *p == 0x36 ||
+             *p == 0x64 || *p == 0x65 || *p == 0x67) continue;
+    else break;
+  }
+  if ((*p & 0xf0) == 0x40) rex = *p ++;
+  bool rex_w = rex & 8;
+  int oplen = (rex_w ? 8 : (opsize16 ? 2 : 4));
+
+  a->rex = (rex != 0);
+  a->sext = false;
+  a->reg_len = oplen;
+  a->imm = 0;
+  int imm_len = 0;
+  uint8_t op = *p ++;
+  switch (op) {
+    case 0x88: a->type = ACC_STORE_REG; a->len = a->reg_len = 1; break;
+    case 0x89: a->type = ACC_STORE_REG; a->len = oplen; break;
+    case 0x8a: a->type = ACC_LOAD; a->len = a->reg_len = 1; break;
+    case 0x8b: a->type = ACC_LOAD; a->len = oplen; break;
+    case 0x63: a->type = ACC_LOAD; a->len = 4; a->sext = true; break; // movsxd
+    case 0xc6: a->type = ACC_STORE_IMM; a->len = 1; imm_len = 1; break;
+    case 0xc7: a->type = ACC_STORE_IMM; a->len = oplen; imm_len = (opsize16 ? 2 : 4); break;
+    case 0x0f:
+      a->type = ACC_LOAD;
+      switch (*p ++) {
+        case 0xb6: a->len = 1; break; // movzx
+        case 0xb7: a->len = 2; break;
+        case 0xbe: a->len = 1; a->sext = true; break; // movsx
+        case 0xbf: a->len = 2; a->sext = true; break;
+        default: return false;
+      }
+      break;
+    default: return false;
+  }
+
+  // ModR/M, SIB and displacement
+  uint8_t modrm = *p ++;
+  int mod = modrm >> 6;
+  int rm = (modrm & 7) | ((rex & 1) << 3);
+  a->reg = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+  if (mod == 3) return false;
+
+  uint64_t ea = 0;
+  if ((modrm & 7) == 4) {
+    uint8_t sib = *p ++;
+    int scale = sib >> 6;
+    int index = ((sib >> 3) & 7) | ((rex & 2) << 2);
+    int base = (sib & 7) | ((rex & 1) << 3);
+    if (index != 4) ea += get_greg(gregs, index) << scale;
+    if ((sib & 7) == 5 && mod == 0) { ea += *(int32_t *)p; p += 4; }
+    else ea += get_greg(gregs, base);
+  } else if ((modrm & 7) == 5 && mod == 0) {
+    return false; // RIP-relative, never points into the guest space
+  } else {
+    ea += get_greg(gregs, rm);
+  }
+  if (mod == 1) { ea += *(int8_t *)p; p += 1; }
+  else if (mod == 2) { ea += *(int32_t *)p; p += 4; }
+
+  switch (imm_len) {
+    case 1: a->imm = *(uint8_t *)p; break;
+    case 2: a->imm = *(uint16_t *)p; break;
+    case 4: a->imm = (uint64_t)(int64_t)*(int32_t *)p; break;
+  }
+  p += imm_len;
+
+  a->ea = ea;
+  a->ilen = p - start;
+  return true;
+}
+
+static uint64_t read_reg(greg_t *gregs, HostAccess *a) {
+  if (a->len == 1 && !a->rex && a->reg >= 4) { // ah, ch, dh, bh
+    return (get_greg(gregs, a->reg - 4) >> 8) & 0xff;
+  }
+  return get_greg(gregs, a->reg);
+}
+
+static void write_reg(greg_t *gregs, HostAccess *a, uint64_t val) {
+  uint64_t *r = (uint64_t *)&gregs[greg_idx[a->reg]];
+  if (a->reg_len == 1 && !a->rex && a->reg >= 4) {
+    r = (uint64_t *)&gregs[greg_idx[a->reg - 4]];
+    *r = (*r & ~0xff00ull) | ((val & 0xff) << 8);
+    return;
+  }
+  if (a->sext) {
+    int shift = 64 - a->len * 8;
+    val = (uint64_t)((int64_t)(val << shift) >> shift);
+  }
+  switch (a->reg_len) {
+    case 8: *r = val; break;
+    case 4: *r = (uint32_t)val; break; // a 32-bit destination clears the upper half
+    default: { // 8/16-bit destinations keep the upper bits
+      uint64_t mask = BITMASK(a->reg_len * 8);
+      *r = (*r & ~mask) | (val & mask);
+    }
+  }
+}
+
+// Emulate an access to the non-pmem part of the guest physical space.
+// Return false if the fault does not come from such an access.
+bool fixmap_handle_fault(uint8_t *fault, ucontext_t *uc) {
+  greg_t *gregs = uc->uc_mcontext.gregs;
+  HostAccess a;
+  if (fault < fixmap_base || fault >= fixmap_base + fixmap_size ||
+      !decode_host_access((uint8_t *)gregs[REG_RIP], gregs, &a)) {
+    return false;
+  }
+
+  paddr_t addr = (uint8_t *)a.ea - fixmap_base;
+  if (a.type == ACC_LOAD) {
+    write_reg(gregs, &a, paddr_fault_read(addr, a.len));
+  } else {
+    uint64_t data = (a.type == ACC_STORE_IMM ? a.imm : read_reg(gregs, &a));
+    paddr_fault_write(addr, a.len, data);
+  }
+  gregs[REG_RIP] += a.ilen;
+  return true;
+}
+
+void init_fixmap(uint8_t *base, size_t size) {
+  fixmap_base = base;
+  fixmap_size = size;
+  Log("guest physical space is mapped at host address %p", fixmap_base);
+}
+#endif
@@ -0,0 +1,121 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#if defined(CONFIG_PMEM_MMAP) || defined(CONFIG_PMEM_FIXMAP)
+#include <sys/mman.h>
+#include <signal.h>
+#include <ucontext.h>
+
+#define HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+
+#ifdef CONFIG_PMEM_FIXMAP
+// one extra page so that an access at the very top of the guest physical
+// space still faults inside the reserved window
+#define RESERVE_SIZE ((1ull << 32) + PAGE_SIZE)
+#define PMEM_OFFSET  CONFIG_MBASE
+void init_fixmap(uint8_t *base, size_t size);
+bool fixmap_handle_fault(uint8_t *fault, ucontext_t *uc);
+#else
+#define RESERVE_SIZE CONFIG_MSIZE
+#define PMEM_OFFSET  0
+#endif
+
+static uint8_t *pmem_base = NULL;
+
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+// pmem starts as PROT_NONE and is filled chunk by chunk on first touch
+#define LAZY_CHUNK HUGE_PAGE_SIZE
+static uint8_t fill_byte = 0;
+
+static bool lazy_fill(uint8_t *fault) {
+  if (fault < pmem_base || fault >= pmem_base + CONFIG_MSIZE) return false;
+  uint8_t *chunk = pmem_base + ROUNDDOWN((fault - pmem_base), LAZY_CHUNK);
+  size_t size = pmem_base + CONFIG_MSIZE - chunk;
+  if (size > LAZY_CHUNK) size = LAZY_CHUNK;
+  if (mprotect(chunk, size, PROT_READ | PROT_WRITE) != 0) return false;
+  memset(chunk, fill_byte, size);
+  return true;
+}
+
+void pmem_populate(paddr_t addr, size_t len) {
+  // a read is enough to take the fault, and a filled chunk does not fault again
+  uint8_t *p = guest_to_host(addr);
+  for (size_t i = 0; i < len; i += LAZY_CHUNK) {
+    (void)*(volatile uint8_t *)(p + i);
+  }
+  if (len > 0) (void)*(volatile uint8_t *)(p + len - 1);
+}
+#endif
+
+#if defined(CONFIG_PMEM_LAZY_RANDOM) || defined(CONFIG_PMEM_FIXMAP)
+static void pmem_fault_handler(int sig, siginfo_t *info, void *uc) {
+  uint8_t *fault = info->si_addr;
+  IFDEF(CONFIG_PMEM_LAZY_RANDOM, if (lazy_fill(fault)) return);
+  IFDEF(CONFIG_PMEM_FIXMAP, if (fixmap_handle_fault(fault, uc)) return);
+  // not ours, let the default action take place when the access restarts
+  signal(SIGSEGV, SIG_DFL);
+}
+#endif
+
+static uint8_t* reserve(size_t size) {
+  // over-reserve to align the window to a huge page
+  uint8_t *p = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "Can not reserve %#zx bytes of host address space", size);
+  uint8_t *base = (uint8_t *)ROUNDUP(p, HUGE_PAGE_SIZE);
+  if (base != p) munmap(p, base - p);
+  munmap(base + size, p + HUGE_PAGE_SIZE - base);
+  return base;
+}
+
+uint8_t* init_pmem_mmap() {
+  uint8_t *window = reserve(RESERVE_SIZE);
+  pmem_base = window + PMEM_OFFSET;
+
+  int prot = MUXDEF(CONFIG_PMEM_LAZY_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE);
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED;
+  void *p = MAP_FAILED;
+#ifdef CONFIG_PMEM_HUGEPAGE_HUGETLB
+  if (CONFIG_MSIZE % HUGE_PAGE_SIZE == 0 && (uintptr_t)pmem_base % HUGE_PAGE_SIZE == 0) {
+    // without MAP_NORESERVE, mmap() fails early if the huge page pool is too small
+    p = mmap(pmem_base, CONFIG_MSIZE, prot, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+  }
+  if (p == MAP_FAILED) Log("No huge pages for pmem, fall back to normal pages");
+#endif
+  if (p == MAP_FAILED) p = mmap(pmem_base, CONFIG_MSIZE, prot, flags, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map pmem");
+  IFDEF(CONFIG_PMEM_HUGEPAGE_THP, madvise(pmem_base, CONFIG_MSIZE, MADV_HUGEPAGE));
+
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+  fill_byte = rand();
+#endif
+#if defined(CONFIG_PMEM_LAZY_RANDOM) || defined(CONFIG_PMEM_FIXMAP)
+  IFDEF(CONFIG_PMEM_FIXMAP, init_fixmap(window, RESERVE_SIZE));
+  struct sigaction s;
+  memset(&s, 0, sizeof(s));
+  s.sa_sigaction = pmem_fault_handler;
+  // MMIO callbacks run inside the handler, let a real crash there fault again
+  s.sa_flags = SA_SIGINFO | SA_NODEFER;
+  int ret = sigaction(SIGSEGV, &s, NULL);
+  Assert(ret == 0, "Can not set signal handler");
+#endif
+  return pmem_base;
+}
+#endif
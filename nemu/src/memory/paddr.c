@@ -15,11 +15,13 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/cpu.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP) || defined(CONFIG_PMEM_FIXMAP)
+static MACHINE_LOCAL uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
@@ -27,16 +29,67 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
+#ifdef CONFIG_TARGET_LIB
+void pmem_bind(uint8_t *p) { pmem = p; }
+#endif
+
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
 }
 
+#ifdef CONFIG_PMEM_DIRTY
+#define NR_PMEM_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+static dirty_mark_t *page_epoch = NULL;
+static dirty_mark_t cur_epoch = DIRTY_MARK_BOOT; // 0 means never written
+
+static inline void dirty_page(paddr_t addr) {
+  paddr_t idx = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  // with fixmap, MMIO stores also come through pmem_write()
+  IFDEF(CONFIG_PMEM_FIXMAP, if (idx >= NR_PMEM_PAGE) return);
+  page_epoch[idx] = cur_epoch;
+}
+
+dirty_mark_t pmem_dirty_mark() {
+  return ++ cur_epoch;
+}
+
+void pmem_dirty_set(paddr_t addr, size_t len) {
+  if (len == 0) return;
+  assert(in_pmem(addr) && in_pmem(addr + len - 1));
+  for (paddr_t pg = ROUNDDOWN(addr, PAGE_SIZE); pg <= addr + len - 1; pg += PAGE_SIZE) {
+    dirty_page(pg);
+  }
+}
+
+size_t pmem_dirty_count(dirty_mark_t since) {
+  size_t n = 0;
+  for (size_t i = 0; i < NR_PMEM_PAGE; i ++) {
+    n += (page_epoch[i] >= since);
+  }
+  return n;
+}
+
+void pmem_dirty_foreach(dirty_mark_t since, dirty_range_handler_t handler, void *arg) {
+  size_t i = 0;
+  while (i < NR_PMEM_PAGE) {
+    if (page_epoch[i] < since) { i ++; continue; }
+    size_t j = i + 1;
+    while (j < NR_PMEM_PAGE && page_epoch[j] >= since) j ++;
+    handler(PMEM_LEFT + i * PAGE_SIZE, (j - i) * PAGE_SIZE, arg);
+    i = j;
+  }
+}
+#endif
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
+  // tag both ends to catch accesses crossing a page boundary without a branch
+  IFDEF(CONFIG_PMEM_DIRTY, dirty_page(addr); dirty_page(addr + len - 1));
 }
 
-static void out_of_bound(paddr_t addr) {
+static void out_of_bound(paddr_t addr, int type) {
+  IFDEF(CONFIG_MEM_ACCESS_FAULT, longjmp_exception(isa_access_fault_no(type)));
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
@@ -45,20 +98,111 @@ void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP) || defined(CONFIG_PMEM_FIXMAP)
+  uint8_t* init_pmem_mmap();
+  pmem = init_pmem_mmap();
 #endif
+#ifndef CONFIG_PMEM_LAZY_RANDOM
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+#endif
+#ifdef CONFIG_PMEM_DIRTY
+  // one more entry for the tail of an access crossing the end of pmem
+  page_epoch = calloc(NR_PMEM_PAGE, sizeof(page_epoch[0]));
+  assert(page_epoch);
+#endif
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+#ifdef CONFIG_PMEM_FIXMAP
+// Every guest physical address has a host mapping, so there is no range check
+// here. Accesses outside pmem hit PROT_NONE pages and reach the bus through
+// paddr_fault_read()/paddr_fault_write(), called from the SIGSEGV handler.
+word_t paddr_read(paddr_t addr, int len) {
+  return pmem_read(addr, len);
+}
+
+void paddr_write(paddr_t addr, int len, word_t data) {
+  pmem_write(addr, len, data);
+}
+
+word_t paddr_fault_read(paddr_t addr, int len) {
+  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  out_of_bound(addr, MEM_TYPE_READ);
+  return 0;
+}
+
+void paddr_fault_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  out_of_bound(addr, MEM_TYPE_WRITE);
+}
+#else
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
-  out_of_bound(addr);
+  out_of_bound(addr, MEM_TYPE_READ);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
-  out_of_bound(addr);
+  out_of_bound(addr, MEM_TYPE_WRITE);
+}
+#endif
+
+static word_t amo_alu(int op, word_t old, word_t val) {
+  switch (op) {
+    case AMO_SWAP: return val;
+    case AMO_ADD:  return old + val;
+    case AMO_XOR:  return old ^ val;
+    case AMO_AND:  return old & val;
+    case AMO_OR:   return old | val;
+    case AMO_MIN:  return ((sword_t)old < (sword_t)val ? old : val);
+    case AMO_MAX:  return ((sword_t)old > (sword_t)val ? old : val);
+    case AMO_MINU: return (old < val ? old : val);
+    case AMO_MAXU: return (old > val ? old : val);
+    default: panic("bad AMO operation %d", op);
+  }
+}
+
+// MMIO, or out of bound
+#define bus_read(addr)        MUXDEF(CONFIG_PMEM_FIXMAP, paddr_fault_read, paddr_read)(addr, sizeof(word_t))
+#define bus_write(addr, data) MUXDEF(CONFIG_PMEM_FIXMAP, paddr_fault_write, paddr_write)(addr, sizeof(word_t), data)
+
+word_t paddr_amo(paddr_t addr, int op, word_t val) {
+  if (unlikely(!in_pmem(addr))) {
+    word_t old = bus_read(addr);
+    bus_write(addr, amo_alu(op, old, val));
+    return old;
+  }
+  word_t *p = (word_t *)guest_to_host(addr);
+  IFDEF(CONFIG_PMEM_DIRTY, dirty_page(addr));
+#ifdef CONFIG_TARGET_AM
+  // no other thread, and the host may not have atomic instructions
+  word_t old = *p;
+  *p = amo_alu(op, old, val);
+#else
+  word_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(p, &old, amo_alu(op, old, val), true,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+#endif
+  return old;
+}
+
+bool paddr_cas(paddr_t addr, word_t expected, word_t val) {
+  if (unlikely(!in_pmem(addr))) {
+    if (bus_read(addr) != expected) return false;
+    bus_write(addr, val);
+    return true;
+  }
+  word_t *p = (word_t *)guest_to_host(addr);
+#ifdef CONFIG_TARGET_AM
+  if (*p != expected) return false;
+  *p = val;
+#else
+  if (!__atomic_compare_exchange_n(p, &expected, val, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return false;
+#endif
+  IFDEF(CONFIG_PMEM_DIRTY, dirty_page(addr));
+  return true;
 }
@@ -15,8 +15,11 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
+  // instructions can only be fetched from pmem
+  IFDEF(CONFIG_MEM_ACCESS_FAULT, if (!in_pmem(addr)) longjmp_exception(isa_access_fault_no(MEM_TYPE_IFETCH)));
   return paddr_read(addr, len);
 }
 
@@ -27,3 +30,11 @@ word_t vaddr_read(vaddr_t addr, int len) {
 void vaddr_write(vaddr_t addr, int len, word_t data) {
   paddr_write(addr, len, data);
 }
+
+word_t vaddr_amo(vaddr_t addr, int op, word_t val) {
+  return paddr_amo(addr, op, val);
+}
+
+bool vaddr_cas(vaddr_t addr, word_t expected, word_t val) {
+  return paddr_cas(addr, expected, val);
+}
@@ -0,0 +1,169 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <monitor/elf.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Phdr MUXDEF(CONFIG_ISA64, Elf64_Phdr, Elf32_Phdr)
+#define Elf_Shdr MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr)
+#define Elf_Sym  MUXDEF(CONFIG_ISA64, Elf64_Sym,  Elf32_Sym)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+#define ELF_ST_TYPE(i) ((i) & 0xf)
+
+#define ELF_MACHINE MUXDEF(CONFIG_ISA_x86, EM_386, MUXDEF(CONFIG_ISA_mips32, EM_MIPS, \
+    MUXDEF(CONFIG_ISA_riscv, EM_RISCV, 258 /* EM_LOONGARCH */)))
+
+static ElfSymbol *symtab = NULL;
+static int nr_sym = 0;
+
+bool is_elf_file(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+  char magic[SELFMAG];
+  bool ret = (fread(magic, SELFMAG, 1, fp) == 1 && memcmp(magic, ELFMAG, SELFMAG) == 0);
+  fclose(fp);
+  return ret;
+}
+
+static bool remap(uint8_t *haddr, size_t len, int fd, off_t offset) {
+// only pmem allocated by mmap() can have its pages replaced
+#if defined(CONFIG_PMEM_MMAP) || defined(CONFIG_PMEM_FIXMAP)
+  int flags = MAP_PRIVATE | MAP_FIXED | (fd == -1 ? MAP_ANONYMOUS : 0);
+  return mmap(haddr, len, PROT_READ | PROT_WRITE, flags, fd, offset) != MAP_FAILED;
+#else
+  return false;
+#endif
+}
+
+// Copy the file part of a segment. Whole pages are mapped copy-on-write from
+// the page cache when possible, so that large images load in constant time.
+static void load_file_part(uint8_t *haddr, size_t len, int fd, uint8_t *file, off_t offset) {
+  uint8_t *start = (uint8_t *)ROUNDUP(haddr, PAGE_SIZE);
+  uint8_t *end = (uint8_t *)ROUNDDOWN((haddr + len), PAGE_SIZE);
+  if (((uintptr_t)haddr & PAGE_MASK) == (offset & PAGE_MASK) && end > start &&
+      remap(start, end - start, fd, offset + (start - haddr))) {
+    memcpy(haddr, file + offset, start - haddr);
+    memcpy(end, file + offset + (end - haddr), haddr + len - end);
+    return;
+  }
+  memcpy(haddr, file + offset, len);
+}
+
+// Zero-fill `.bss'. Whole pages are replaced by fresh anonymous pages, which
+// the host kernel zero-fills lazily on first touch.
+static void load_zero_part(uint8_t *haddr, size_t len) {
+  uint8_t *start = (uint8_t *)ROUNDUP(haddr, PAGE_SIZE);
+  uint8_t *end = (uint8_t *)ROUNDDOWN((haddr + len), PAGE_SIZE);
+  if (end > start && remap(start, end - start, -1, 0)) {
+    memset(haddr, 0, start - haddr);
+    memset(end, 0, haddr + len - end);
+    return;
+  }
+  memset(haddr, 0, len);
+}
+
+static int symbol_cmp(const void *a, const void *b) {
+  vaddr_t x = ((ElfSymbol *)a)->addr, y = ((ElfSymbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symtab(uint8_t *file, Elf_Ehdr *eh) {
+  Elf_Shdr *sh = (Elf_Shdr *)(file + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf_Sym *sym = (Elf_Sym *)(file + sh[i].sh_offset);
+    const char *strtab = (const char *)file + sh[sh[i].sh_link].sh_offset;
+    int n = sh[i].sh_size / sizeof(Elf_Sym);
+    symtab = malloc(sizeof(ElfSymbol) * n);
+    assert(symtab);
+    for (int j = 0; j < n; j ++) {
+      int type = ELF_ST_TYPE(sym[j].st_info);
+      if (type != STT_FUNC && type != STT_OBJECT) continue;
+      // names point into the mapping of the file, which is kept
+      symtab[nr_sym ++] = (ElfSymbol) { .name = strtab + sym[j].st_name,
+        .addr = sym[j].st_value, .size = sym[j].st_size, .is_func = (type == STT_FUNC) };
+    }
+    qsort(symtab, nr_sym, sizeof(ElfSymbol), symbol_cmp);
+    return;
+  }
+}
+
+long load_elf(const char *file, vaddr_t *entry) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd != -1, "Can not open '%s'", file);
+  struct stat st;
+  fstat(fd, &st);
+  uint8_t *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(buf != MAP_FAILED, "Can not map '%s'", file);
+
+  Elf_Ehdr *eh = (Elf_Ehdr *)buf;
+  Assert(eh->e_ident[EI_CLASS] == ELF_CLASS && eh->e_ident[EI_DATA] == ELFDATA2LSB &&
+      eh->e_type == ET_EXEC && eh->e_machine == ELF_MACHINE,
+      "'%s' is not an executable for %s", file, str(__GUEST_ISA__));
+
+  paddr_t img_end = RESET_VECTOR;
+  Elf_Phdr *ph = (Elf_Phdr *)(buf + eh->e_phoff);
+  for (int i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    Assert(in_pmem(addr) && in_pmem(addr + ph[i].p_memsz - 1),
+        "segment [" FMT_PADDR ", " FMT_PADDR ") is out of pmem", addr, (paddr_t)(addr + ph[i].p_memsz));
+    // fill the chunks before the segment is remapped, or the fill wipes it
+    pmem_populate(addr, ph[i].p_memsz);
+    uint8_t *haddr = guest_to_host(addr);
+    load_file_part(haddr, ph[i].p_filesz, fd, buf, ph[i].p_offset);
+    load_zero_part(haddr + ph[i].p_filesz, ph[i].p_memsz - ph[i].p_filesz);
+    pmem_dirty_set(addr, ph[i].p_memsz);
+    Log("segment [" FMT_PADDR ", " FMT_PADDR ") loaded", addr, (paddr_t)(addr + ph[i].p_memsz));
+    if (addr + ph[i].p_memsz > img_end) img_end = addr + ph[i].p_memsz;
+  }
+
+  load_symtab(buf, eh);
+  *entry = eh->e_entry;
+  close(fd);
+  return img_end - RESET_VECTOR;
+}
+
+const ElfSymbol* elf_find_symbol(vaddr_t addr) {
+  int l = 0, r = nr_sym - 1, found = -1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (symtab[m].addr <= addr) { found = m; l = m + 1; }
+    else r = m - 1;
+  }
+  if (found == -1) return NULL;
+  ElfSymbol *s = &symtab[found];
+  return (addr < s->addr + s->size || addr == s->addr ? s : NULL);
+}
+
+const ElfSymbol* elf_lookup_symbol(const char *name) {
+  for (int i = 0; i < nr_sym; i ++) {
+    if (strcmp(symtab[i].name, name) == 0) return &symtab[i];
+  }
+  return NULL;
+}
+#endif
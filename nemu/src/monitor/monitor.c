@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <monitor/elf.h>
+#include <device/replay.h>
 
 void init_rand();
 void init_log(const char *log_file);
@@ -23,6 +25,7 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
+void init_smp();
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN),
@@ -45,6 +48,8 @@ void sdb_set_batch_mode();
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *record_file = NULL;
+static char *replay_file = NULL;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -53,6 +58,14 @@ static long load_img() {
     return 4096; // built-in image size
   }
 
+  if (is_elf_file(img_file)) {
+    vaddr_t entry;
+    long size = load_elf(img_file, &entry);
+    Log("The image is %s (ELF), entry = " FMT_WORD, img_file, entry);
+    cpu.pc = entry;
+    return size;
+  }
+
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
@@ -62,8 +75,10 @@ static long load_img() {
   Log("The image is %s, size = %ld", img_file, size);
 
   fseek(fp, 0, SEEK_SET);
+  pmem_populate(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
+  pmem_dirty_set(RESET_VECTOR, size);
 
   fclose(fp);
   return size;
@@ -75,6 +90,8 @@ static int parse_args(int argc, char *argv[]) {
       {"log", required_argument, NULL, 'l'},
       {"diff", required_argument, NULL, 'd'},
       {"port", required_argument, NULL, 'p'},
+      {"record", required_argument, NULL, 'r'},
+      {"replay", required_argument, NULL, 'R'},
       {"help", no_argument, NULL, 'h'},
       {0, 0, NULL, 0},
   };
@@ -93,6 +110,12 @@ static int parse_args(int argc, char *argv[]) {
     case 'd':
       diff_so_file = optarg;
       break;
+    case 'r':
+      record_file = optarg;
+      break;
+    case 'R':
+      replay_file = optarg;
+      break;
     case 1:
       img_file = optarg;
       return 0;
@@ -102,6 +125,8 @@ static int parse_args(int argc, char *argv[]) {
       printf("\t-l,--log=FILE           output log to FILE\n");
       printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
       printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+      printf("\t--record=FILE           record the inputs of devices to FILE\n");
+      printf("\t--replay=FILE           replay the inputs of devices from FILE\n");
       printf("\n");
       exit(0);
     }
@@ -124,6 +149,10 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
+  /* Open the log of the inputs of devices. */
+  IFDEF(CONFIG_REPLAY, init_replay(record_file, replay_file));
+  IFNDEF(CONFIG_REPLAY, if (record_file || replay_file) Log("REPLAY is not enabled, ignore --record and --replay"));
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -133,6 +162,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Start the other harts from the reset state. */
+  IFDEF(CONFIG_SMP, init_smp());
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
@@ -17,7 +17,9 @@
 #include "utils.h"
 #include <common.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <isa.h>
+#include <memory/paddr.h>
 #include <memory/vaddr.h>
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -148,6 +150,58 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_DIFFTEST
+static int cmd_detach(char *args) {
+  difftest_detach();
+  return 0;
+}
+
+static int cmd_attach(char *args) {
+  difftest_attach();
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_PMEM_DIRTY
+static void print_dirty_range(paddr_t addr, size_t len, void *arg) {
+  printf("  [" FMT_PADDR ", " FMT_PADDR "] %zu KB\n", addr, (paddr_t)(addr + len - 1), len / 1024);
+}
+
+static int cmd_ws(char *args) {
+  static dirty_mark_t mark = DIRTY_MARK_BOOT;
+  char *arg = strtok(NULL, " ");
+  if (arg == NULL) {
+    // pages written since the last `ws'
+    size_t n = pmem_dirty_count(mark);
+    printf("%zu pages (%zu KB) written\n", n, n * PAGE_SIZE / 1024);
+    pmem_dirty_foreach(mark, print_dirty_range, NULL);
+    mark = pmem_dirty_mark();
+    return 0;
+  }
+
+  // working set over time: `ws N K' runs K intervals of N instructions
+  uint64_t n = 0;
+  int k = 1;
+  sscanf(arg, "%" SCNu64, &n);
+  arg = strtok(NULL, " ");
+  if (arg != NULL) sscanf(arg, "%d", &k);
+  if (n == 0 || k <= 0) {
+    printf("Invalid argument\n");
+    return 0;
+  }
+  dirty_mark_t start = pmem_dirty_mark();
+  printf("%-8s %-12s %-12s\n", "interval", "pages", "total pages");
+  for (int i = 0; i < k; i ++) {
+    mark = pmem_dirty_mark();
+    cpu_exec(n);
+    printf("%-8d %-12zu %-12zu\n", i, pmem_dirty_count(mark), pmem_dirty_count(start));
+    if (nemu_state.state != NEMU_STOP) break;
+  }
+  mark = pmem_dirty_mark();
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -164,6 +218,13 @@ static struct {
     {"p", "Print value of expression", cmd_p},
     {"w", "Set a watchpoint", cmd_w},
     {"d", "Delete a watchpoint", cmd_d},
+#ifdef CONFIG_DIFFTEST
+    {"detach", "Stop difftest, and run at full speed", cmd_detach},
+    {"attach", "Copy the state of DUT to REF, and restart difftest", cmd_attach},
+#endif
+#ifdef CONFIG_PMEM_DIRTY
+    {"ws", "Show pages written since the last `ws', or `ws N K' for K intervals of N instructions", cmd_ws},
+#endif
     // {"bt", "Print backtrace of all stack frames", cmd_bt},
     // {"cache", "Print cache status", cmd_cache},
     // {"tlb", "Print tlb status", cmd_tlb},
@@ -233,7 +294,6 @@ void sdb_mainloop() {
     for (i = 0; i < NR_CMD; i++) {
       if (strcmp(cmd, cmd_table[i].name) == 0) {
         if (cmd_table[i].handler(args) < 0) {
-          extern NEMUState nemu_state;
           nemu_state.state = NEMU_QUIT;
           return;
         }
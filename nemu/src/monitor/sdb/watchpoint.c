@@ -105,7 +105,6 @@ void wp_check() {
       return;
     }
     if (_new != p->value) {
-      extern NEMUState nemu_state;
       nemu_state.state = NEMU_STOP;
       printf("Watchpoint %d: %s\n", p->NO, p->expr);
       printf("Old value = %u\n", p->value);
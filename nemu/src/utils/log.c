@@ -14,8 +14,9 @@
 ***************************************************************************************/
 
 #include <common.h>
+#include <cpu/cpu.h>
 
-extern uint64_t g_nr_guest_inst;
+extern HART_LOCAL uint64_t g_nr_guest_inst;
 
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
@@ -31,6 +32,7 @@ void init_log(const char *log_file) {
 }
 
 bool log_enable() {
+  IFDEF(CONFIG_SNAPSHOT, if (snapshot_replaying) return true);
   return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) &&
          (g_nr_guest_inst <= CONFIG_TRACE_END), false);
 }
@@ -15,7 +15,7 @@
 
 #include <utils.h>
 
-NEMUState nemu_state = {.state = NEMU_STOP};
+MACHINE_LOCAL NEMUState nemu_state = {.state = NEMU_STOP};
 
 int is_exit_status_bad() {
   int good = (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ||